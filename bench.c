@@ -0,0 +1,641 @@
+/* bench.c: benchmark harness for the GMPBBS Blum Blum Shub PRNG
+
+  Copyright 2015 Maria Morisot.
+
+  This file is released under the GPL.
+
+  GMPBBS is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License,
+  or (at your option) any later version.
+
+  GMPBBS is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+  for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with GMPBBS; see the file LICENSE.  If not, write to
+  the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+  MA 02111-1307, USA.
+*/
+
+/*
+  every benchmark is run `warmup' times untimed, then `repeats' times
+  timed; we report min/median/mean wall time and the rate at the median.
+  keys are generated once per key size and shared by the byte benchmarks,
+  so only the keygen rows pay for the random device.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "gmpbbs.h"
+#include "output.h"
+
+#define FMT_TEXT 0
+#define FMT_CSV 1
+#define FMT_JSON 2
+
+#define T_KEYGEN 0x01
+#define T_BYTES 0x02
+#define T_XOR 0x04
+#define T_RANDINT 0x08
+#define T_ENCODE 0x10
+#define T_FLOAT 0x20
+#define T_SHUFFLE 0x40
+#define T_ALL 0xff
+
+static int format = FMT_TEXT;
+static int repeats = 5;
+static int warmup = 1;
+static int keygen_repeats = 3;
+static size_t nbytes = 32768;
+static FILE *outf;
+static FILE *devnull;
+static int rows = 0;
+
+static const unsigned int randint_bases[] = { 2, 10, 16, 1000, 65536 };
+static const size_t randint_counts[] = { 16, 256, 4096 };
+
+void usage (const char *me)
+{
+  fprintf(stderr,
+	  "usage: %s [-h] [-o outfile] [-f text|csv|json] [-k keylen,...]\n"
+	  "      \t[-n bytes] [-r repeats] [-w warmup] [-g keygen_repeats]\n"
+	  "      \t[-t keygen,bytes,xor,randint,encode,float,\n"
+	  "      \t shuffle]\n\n"
+	  "   -h, --help    :\tthis help message\n"
+	  "   -o, --output  :\tfile to write results to\n"
+	  "   -f, --format  :\tresult format (default text)\n"
+	  "   -k, --keylen  :\tkey lengths to benchmark (default 512,1024,2048)\n"
+	  "   -n, --bytes   :\tbytes generated per timed run (default %lu)\n"
+	  "   -r, --repeats :\ttimed runs per benchmark (default %d)\n"
+	  "   -w, --warmup  :\tuntimed runs per benchmark (default %d)\n"
+	  "   -g, --keygen  :\ttimed key generations per key length (default %d)\n"
+	  "   -t, --tests   :\tbenchmarks to run (default all)\n"
+	  , me, (unsigned long) nbytes, repeats, warmup, keygen_repeats);
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return( (x > y) - (x < y) );
+}
+
+/*
+  print one result row.
+    work is how many `unit's one run produces (bytes, keys, ints)
+*/
+static void report(const char *bench, unsigned int keylen, const char *param,
+		   size_t size, double *secs, int n,
+		   double work, const char *unit)
+{
+  double min, median, mean = 0, rate;
+  int i;
+
+  qsort(secs, n, sizeof(double), cmp_double);
+  min = secs[0];
+  median = (n % 2) ? secs[n/2] : (secs[n/2-1] + secs[n/2]) / 2;
+  for (i=0;i<n;i++)
+    mean += secs[i];
+  mean /= n;
+  rate = (median > 0) ? work / median : 0;
+
+  switch(format)
+    {
+    case FMT_CSV:
+      if (rows == 0)
+	fprintf(outf, "benchmark,key_bitlen,param,size,repeats,"
+		"min_s,median_s,mean_s,rate,unit\n");
+      fprintf(outf, "%s,%u,%s,%lu,%d,%.9f,%.9f,%.9f,%.3f,%s\n",
+	      bench, keylen, param, (unsigned long) size, n,
+	      min, median, mean, rate, unit);
+      break;
+    case FMT_JSON:
+      fprintf(outf, "%s\n  {\"benchmark\": \"%s\", \"key_bitlen\": %u, "
+	      "\"param\": \"%s\", \"size\": %lu, \"repeats\": %d, "
+	      "\"min_s\": %.9f, \"median_s\": %.9f, \"mean_s\": %.9f, "
+	      "\"rate\": %.3f, \"unit\": \"%s\"}",
+	      (rows == 0) ? "[" : ",", bench, keylen, param,
+	      (unsigned long) size, n, min, median, mean, rate, unit);
+      break;
+    default:
+      fprintf(outf, "%-8s k=%-5u %-12s n=%-8lu median %10.6fs "
+	      "(min %10.6fs) %14.1f %s\n",
+	      bench, keylen, param, (unsigned long) size,
+	      median, min, rate, unit);
+      break;
+    }
+  fflush(outf);
+  rows++;
+}
+
+static rndbbs_t *bench_keygen(unsigned int keylen, int do_bench)
+{
+  rndbbs_t *bbs = NULL;
+  double *secs;
+  int i, n = do_bench ? keygen_repeats : 1;
+
+  if ( (secs = (double *) malloc(n * sizeof(double))) == NULL )
+    {
+      perror("malloc");
+      return(NULL);
+    }
+
+  for (i=0;i<n;i++)
+    {
+      double t0;
+
+      if (bbs != NULL)
+	rndbbs_destroy(bbs);
+      if ( (bbs = rndbbs_new()) == NULL )
+	break;
+
+      t0 = now();
+      if ( !rndbbs_gen_blumint(bbs, keylen) || !rndbbs_gen_x(bbs) )
+	{
+	  fprintf(stderr, "key generation failed for k=%u\n", keylen);
+	  rndbbs_destroy(bbs);
+	  bbs = NULL;
+	  break;
+	}
+      secs[i] = now() - t0;
+    }
+
+  if ( do_bench && (bbs != NULL) )
+    report("keygen", keylen, "-", keylen, secs, n, 1, "keys/s");
+  free(secs);
+
+  return(bbs);
+}
+
+static int bench_bytes(rndbbs_t *bbs, unsigned int keylen,
+		       const char *name, int improved, int xor_urandom)
+{
+  unsigned char *buf;
+  double *secs;
+  int i;
+
+  if ( (buf = (unsigned char *) malloc(nbytes)) == NULL )
+    {
+      perror("malloc");
+      return(0);
+    }
+  if ( (secs = (double *) malloc(repeats * sizeof(double))) == NULL )
+    {
+      perror("malloc");
+      free(buf);
+      return(0);
+    }
+
+  bbs->improved = improved;
+  bbs->xor_urandom = xor_urandom;
+
+  for (i=0;i<warmup+repeats;i++)
+    {
+      double t0 = now();
+
+      if (!rndbbs_fillbytes(bbs, buf, nbytes))
+	{
+	  free(secs);
+	  free(buf);
+	  return(0);
+	}
+      if (i >= warmup)
+	secs[i-warmup] = now() - t0;
+    }
+
+  bbs->improved = 1;
+  bbs->xor_urandom = 0;
+
+  report("bytes", keylen, name, nbytes, secs, repeats, nbytes, "B/s");
+
+  free(secs);
+  free(buf);
+  return(1);
+}
+
+static int bench_randint(rndbbs_t *bbs, unsigned int keylen)
+{
+  double *secs;
+  size_t b, c;
+
+  if ( (secs = (double *) malloc(repeats * sizeof(double))) == NULL )
+    {
+      perror("malloc");
+      return(0);
+    }
+
+  for (b=0;b<sizeof(randint_bases)/sizeof(randint_bases[0]);b++)
+    for (c=0;c<sizeof(randint_counts)/sizeof(randint_counts[0]);c++)
+      {
+	char param[32];
+	int i;
+
+	for (i=0;i<warmup+repeats;i++)
+	  {
+	    unsigned int *rndint;
+	    double t0 = now();
+
+	    if ( (rndint = rndbbs_randint(bbs, randint_bases[b],
+					  randint_counts[c])) == NULL )
+	      {
+		free(secs);
+		return(0);
+	      }
+	    if (i >= warmup)
+	      secs[i-warmup] = now() - t0;
+	    free(rndint);
+	  }
+
+	snprintf(param, sizeof(param), "base=%u", randint_bases[b]);
+	report("randint", keylen, param, randint_counts[c], secs, repeats,
+	       randint_counts[c], "ints/s");
+      }
+
+  free(secs);
+  return(1);
+}
+
+/* rndbbs_rand_double()/rndbbs_rand_float() over an nbytes sized array */
+static int bench_float(rndbbs_t *bbs, unsigned int keylen)
+{
+  void *buf;
+  double *secs;
+  int pass;
+
+  if ( (buf = malloc(nbytes)) == NULL )
+    {
+      perror("malloc");
+      return(0);
+    }
+  if ( (secs = (double *) malloc(repeats * sizeof(double))) == NULL )
+    {
+      perror("malloc");
+      free(buf);
+      return(0);
+    }
+
+  for (pass=0;pass<2;pass++)
+    {
+      size_t n = nbytes / (pass ? sizeof(float) : sizeof(double));
+      int i;
+
+      if (n == 0)
+	continue;
+
+      for (i=0;i<warmup+repeats;i++)
+	{
+	  double t0 = now();
+	  int ok = pass ? rndbbs_rand_float(bbs, (float *) buf, n)
+	    : rndbbs_rand_double(bbs, (double *) buf, n);
+
+	  if (!ok)
+	    {
+	      free(secs);
+	      free(buf);
+	      return(0);
+	    }
+	  if (i >= warmup)
+	    secs[i-warmup] = now() - t0;
+	}
+
+      report("float", keylen, pass ? "float" : "double", n, secs, repeats,
+	     n, "values/s");
+    }
+
+  free(secs);
+  free(buf);
+  return(1);
+}
+
+/* rndbbs_shuffle() of nbytes/4 32-bit ints, rndbbs_sample() of 1% of them */
+static int bench_shuffle(rndbbs_t *bbs, unsigned int keylen)
+{
+  size_t n = nbytes / sizeof(uint32_t), k = n / 100 + 1;
+  uint32_t *arr;
+  size_t *idx;
+  double *secs;
+  int pass;
+
+  if (n < 2)
+    return(1);
+  if ( (arr = (uint32_t *) malloc(n * sizeof(uint32_t))) == NULL )
+    {
+      perror("malloc");
+      return(0);
+    }
+  if ( (idx = (size_t *) malloc(k * sizeof(size_t))) == NULL )
+    {
+      perror("malloc");
+      free(arr);
+      return(0);
+    }
+  if ( (secs = (double *) malloc(repeats * sizeof(double))) == NULL )
+    {
+      perror("malloc");
+      free(idx);
+      free(arr);
+      return(0);
+    }
+
+  for (pass=0;pass<2;pass++)
+    {
+      int i;
+
+      for (i=0;i<warmup+repeats;i++)
+	{
+	  double t0 = now();
+	  int ok = pass ? rndbbs_sample(bbs, idx, k, n)
+	    : rndbbs_shuffle(bbs, arr, n, sizeof(uint32_t));
+
+	  if (!ok)
+	    {
+	      free(secs);
+	      free(idx);
+	      free(arr);
+	      return(0);
+	    }
+	  if (i >= warmup)
+	    secs[i-warmup] = now() - t0;
+	}
+
+      if (pass)
+	report("shuffle", keylen, "sample", k, secs, repeats, k, "values/s");
+      else
+	report("shuffle", keylen, "shuffle", n, secs, repeats, n,
+	       "elements/s");
+    }
+
+  free(secs);
+  free(idx);
+  free(arr);
+  return(1);
+}
+
+/*
+  gmpbbs -B, -H, -b 10 and -F, through the code gmpbbs itself runs
+    (output.c), into /dev/null.  generation is included: the -b and -F
+    paths draw their values as they go, compare with the bytes rows.
+    rates are in output bytes.
+*/
+static int bench_encode(rndbbs_t *bbs, unsigned int keylen)
+{
+  static const struct
+  {
+    const char *name;
+    int representation; /* as in main.c: 256 -B, 16 -H, 0 -F, else -b */
+  } encodings[] =
+    {
+      { "binary", 256 },
+      { "hex", 16 },
+      { "decimal", 10 },
+      { "float", 0 },
+    };
+  double *secs;
+  size_t e;
+
+  if ( (secs = (double *) malloc(repeats * sizeof(double))) == NULL )
+    {
+      perror("malloc");
+      return(0);
+    }
+
+  for (e=0;e<sizeof(encodings)/sizeof(encodings[0]);e++)
+    {
+      gmpbbs_output_t out;
+      int i, ok = 1;
+
+      for (i=0;i<warmup+repeats;i++)
+	{
+	  double t0 = now();
+
+	  gmpbbs_output_init(&out, devnull);
+	  switch(encodings[e].representation)
+	    {
+	    case 256:
+	      ok = gmpbbs_output_binary(bbs, &out, nbytes);
+	      break;
+	    case 16:
+	      ok = gmpbbs_output_hex(bbs, &out, nbytes);
+	      break;
+	    case 0:
+	      ok = gmpbbs_output_float(bbs, &out, nbytes);
+	      break;
+	    default:
+	      ok = gmpbbs_output_int(bbs, &out,
+				     encodings[e].representation, nbytes);
+	      break;
+	    }
+	  fflush(devnull);
+	  if (!ok)
+	    {
+	      free(secs);
+	      return(0);
+	    }
+	  if (i >= warmup)
+	    secs[i-warmup] = now() - t0;
+	}
+      report("encode", keylen, encodings[e].name, nbytes, secs, repeats,
+	     out.nout, "B/s");
+    }
+
+  free(secs);
+  return(1);
+}
+
+static int parse_tests(const char *arg)
+{
+  static const struct { const char *name; int bit; } names[] =
+    {
+      { "keygen", T_KEYGEN },
+      { "bytes", T_BYTES },
+      { "xor", T_XOR },
+      { "randint", T_RANDINT },
+      { "encode", T_ENCODE },
+      { "float", T_FLOAT },
+      { "shuffle", T_SHUFFLE },
+      { "all", T_ALL },
+    };
+  int tests = 0;
+  char *s, *tok, *save = NULL;
+
+  if ( (s = strdup(arg)) == NULL )
+    return(0);
+
+  for (tok = strtok_r(s, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+      size_t i;
+
+      for (i=0;i<sizeof(names)/sizeof(names[0]);i++)
+	if (strcmp(tok, names[i].name) == 0)
+	  break;
+      if (i == sizeof(names)/sizeof(names[0]))
+	{
+	  free(s);
+	  return(0);
+	}
+      tests |= names[i].bit;
+    }
+
+  free(s);
+  return(tests);
+}
+
+int main(int argc, char **argv)
+{
+  char *out_fn = NULL;
+  const char *keylens = "512,1024,2048";
+  int tests = T_ALL;
+  char *klist, *tok, *save = NULL;
+  int ret = 0;
+
+  int opt, option_index=0;
+
+  static struct option long_options[] =
+    {
+      { "output", 1, NULL, 'o' },
+      { "format", 1, NULL, 'f' },
+      { "keylen", 1, NULL, 'k' },
+      { "bytes", 1, NULL, 'n' },
+      { "repeats", 1, NULL, 'r' },
+      { "warmup", 1, NULL, 'w' },
+      { "keygen", 1, NULL, 'g' },
+      { "tests", 1, NULL, 't' },
+      { "help", 0, NULL, 'h' },
+      { NULL, 0, NULL, 0 }
+    };
+
+  while ((opt =
+	  getopt_long(argc, argv, "ho:f:k:n:r:w:g:t:",
+		      long_options, &option_index)) != -1)
+    {
+      switch(opt)
+	{
+	case 'h':
+	  usage(argv[0]);
+	  return(0);
+	case 'o':
+	  out_fn = optarg;
+	  break;
+	case 'f':
+	  if (strcmp(optarg, "text") == 0)
+	    format = FMT_TEXT;
+	  else if (strcmp(optarg, "csv") == 0)
+	    format = FMT_CSV;
+	  else if (strcmp(optarg, "json") == 0)
+	    format = FMT_JSON;
+	  else
+	    {
+	      usage(argv[0]);
+	      return(1);
+	    }
+	  break;
+	case 'k':
+	  keylens = optarg;
+	  break;
+	case 'n':
+	  nbytes = atol(optarg);
+	  break;
+	case 'r':
+	  repeats = atoi(optarg);
+	  break;
+	case 'w':
+	  warmup = atoi(optarg);
+	  break;
+	case 'g':
+	  keygen_repeats = atoi(optarg);
+	  break;
+	case 't':
+	  tests = parse_tests(optarg);
+	  break;
+	default:
+	  usage(argv[0]);
+	  return(1);
+	}
+    }
+
+  if ( (nbytes < 1) || (repeats < 1) || (warmup < 0) ||
+       (keygen_repeats < 1) || (tests == 0) )
+    {
+      usage(argv[0]);
+      return(1);
+    }
+
+  outf = stdout;
+  if ( (out_fn != NULL) && ((outf = fopen(out_fn, "w")) == NULL) )
+    {
+      perror("fopen");
+      return(1);
+    }
+  if ( (devnull = fopen("/dev/null", "w")) == NULL )
+    {
+      perror("fopen");
+      return(1);
+    }
+
+  if ( (klist = strdup(keylens)) == NULL )
+    {
+      perror("strdup");
+      return(1);
+    }
+
+  for (tok = strtok_r(klist, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+      unsigned int keylen = atoi(tok);
+      rndbbs_t *bbs;
+
+      if (keylen < GMPBBS_MINKEYLEN)
+	{
+	  usage(argv[0]);
+	  ret = 1;
+	  break;
+	}
+
+      if ( (bbs = bench_keygen(keylen, tests & T_KEYGEN)) == NULL )
+	{
+	  ret = 1;
+	  break;
+	}
+
+      if ( ((tests & T_BYTES) &&
+	    ( !bench_bytes(bbs, keylen, "improved", 1, 0) ||
+	      !bench_bytes(bbs, keylen, "slow", 0, 0) )) ||
+	   ((tests & T_XOR) &&
+	    ( !bench_bytes(bbs, keylen, "improved+xor", 1, 1) ||
+	      !bench_bytes(bbs, keylen, "slow+xor", 0, 1) )) ||
+	   ((tests & T_RANDINT) && !bench_randint(bbs, keylen)) ||
+	   ((tests & T_ENCODE) && !bench_encode(bbs, keylen)) ||
+	   ((tests & T_FLOAT) && !bench_float(bbs, keylen)) ||
+	   ((tests & T_SHUFFLE) && !bench_shuffle(bbs, keylen)) )
+	ret = 1;
+
+      rndbbs_destroy(bbs);
+      if (ret)
+	break;
+    }
+
+  if ( (format == FMT_JSON) && (rows > 0) )
+    fprintf(outf, "\n]\n");
+
+  free(klist);
+  fclose(devnull);
+  if (outf != stdout)
+    fclose(outf);
+
+  return(ret);
+}
@@ -0,0 +1,648 @@
+/* cipher.c: file encryption with the GMPBBS Blum Blum Shub PRNG
+
+  Copyright 2015 Maria Morisot.
+
+  This file is released under the GPL.
+
+  GMPBBS is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License,
+  or (at your option) any later version.
+
+  GMPBBS is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+  for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with GMPBBS; see the file LICENSE.  If not, write to
+  the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+  MA 02111-1307, USA.
+*/
+
+/*
+  Blum-Goldwasser style stream cipher: the data is XORed with the
+  BBS output from a fresh x[0], and x[t+1], one squaring past the last
+  x whose bits were used, goes in the header.  whoever has p and q can
+  rewind that to x[0] (rndbbs_rewind()); nobody else can.
+
+  the data is cut into RNDBBS_CIPHER_SEGMENT byte segments, each one
+  rndbbs_fillbytes() call.  we know how many squarings that is, so a
+  thread can jump (rndbbs_jump()) to any segment's x and work on it
+  alone; input and output are mmap()ed and the keystream is generated
+  straight into the output.
+
+  file layout, integers little-endian:
+     0  8  RNDBBS_CIPHER_MAGIC
+     8  4  flags (RNDBBS_CIPHER_IMPROVED)
+    12  4  key length in bits
+    16  8  data length
+    24  8  segment size
+    32  8  t+1
+    40  8  blumint mod 2^64, to catch the wrong key
+    48  .  x[t+1], big-endian, (key length + 7)/8 bytes
+     .  .  data
+*/
+
+
+#include "gmpbbs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define RNDBBS_CIPHER_MAGIC "GMPBBSC\001"
+#define RNDBBS_CIPHER_IMPROVED 0x1
+#define RNDBBS_CIPHER_HDRLEN 48
+
+/* bytes per segment, the unit of work for one thread */
+#ifndef RNDBBS_CIPHER_SEGMENT
+#define RNDBBS_CIPHER_SEGMENT (1 << 20)
+#endif
+
+/* longest line in a key file: "p 0x" + 8192 bit hex + "\n" */
+#define KEYLINE_MAX 4096
+
+static void put_le(unsigned char *p, uint64_t v, int n)
+{
+  int i;
+
+  for (i=0;i<n;i++)
+    p[i] = (unsigned char) (v >> (8*i));
+}
+
+static uint64_t get_le(const unsigned char *p, int n)
+{
+  uint64_t v = 0;
+  int i;
+
+  for (i=n-1;i>=0;i--)
+    v = (v << 8) | p[i];
+
+  return(v);
+}
+
+/* low 64 bits of blumint */
+static uint64_t keycheck(rndbbs_t *bbs)
+{
+  unsigned char buf[8];
+  size_t count;
+  mpz_t t;
+
+  mpz_init(t);
+  mpz_fdiv_r_2exp(t, bbs->blumint, 64);
+  memset(buf, 0, sizeof(buf));
+  mpz_export(buf, &count, -1, 1, 0, 0, t);
+  mpz_clear(t);
+
+  return(get_le(buf, 8));
+}
+
+/* write p and q to fn, readable by the owner only */
+int rndbbs_key_save(rndbbs_t *bbs, const char *fn)
+#define FUNC_NAME "rndbbs_key_save"
+{
+  FILE *f;
+  int fd;
+  char *pstr, *qstr;
+  int ok;
+
+  if ( (mpz_sgn(bbs->p) == 0) || (mpz_sgn(bbs->q) == 0) )
+    return(0);
+
+  if ( (fd = open(fn, O_WRONLY|O_CREAT|O_EXCL, 0600)) == -1 )
+    {
+      perror(FUNC_NAME ": open");
+      return(0);
+    }
+  if ( (f = fdopen(fd, "w")) == NULL )
+    {
+      perror(FUNC_NAME ": fdopen");
+      close(fd);
+      return(0);
+    }
+
+  pstr = mpz_get_str(NULL, 16, bbs->p);
+  qstr = mpz_get_str(NULL, 16, bbs->q);
+  ok = (fprintf(f, "p 0x%s\nq 0x%s\n", pstr, qstr) > 0);
+  free(pstr);
+  free(qstr);
+
+  if ( (fclose(f) != 0) || !ok )
+    {
+      perror(FUNC_NAME ": write");
+      return(0);
+    }
+
+  return(1);
+}
+#undef FUNC_NAME
+
+/* read a key written by rndbbs_key_save() */
+int rndbbs_key_load(rndbbs_t *bbs, const char *fn)
+#define FUNC_NAME "rndbbs_key_load"
+{
+  FILE *f;
+  char *line;
+  mpz_t p, q;
+  int got = 0, ok = 0;
+
+  if ( (f = fopen(fn, "r")) == NULL )
+    {
+      perror(FUNC_NAME ": fopen");
+      return(0);
+    }
+  if ( (line = (char *) malloc(KEYLINE_MAX)) == NULL )
+    {
+      perror(FUNC_NAME ": malloc");
+      fclose(f);
+      return(0);
+    }
+
+  mpz_init(p);
+  mpz_init(q);
+  while (fgets(line, KEYLINE_MAX, f) != NULL)
+    {
+      line[strcspn(line, "\r\n")] = '\0';
+
+      if ( (line[0] == 'p') && (line[1] == ' ') &&
+	   (mpz_set_str(p, line+2, 0) == 0) )
+	got |= 1;
+      else if ( (line[0] == 'q') && (line[1] == ' ') &&
+		(mpz_set_str(q, line+2, 0) == 0) )
+	got |= 2;
+    }
+  free(line);
+  fclose(f);
+
+  if (got == 3)
+    ok = rndbbs_set_key(bbs, p, q);
+  if (!ok)
+    fprintf(stderr, FUNC_NAME ": %s: not a valid key\n", fn);
+
+  mpz_clear(p);
+  mpz_clear(q);
+
+  return(ok);
+}
+#undef FUNC_NAME
+
+typedef struct
+{
+  rndbbs_t *bbs; /* the key, improved, and x[0] */
+  const unsigned char *in;
+  unsigned char *out;
+  uint64_t length;
+  uint64_t nsegs;
+  uint64_t seg_squarings; /* rndbbs_squarings() of a whole segment */
+  uint64_t next; /* next segment to claim */
+  int failed;
+  pthread_mutex_t lock; /* for bbs->stats */
+} cipher_job_t;
+
+/* a private generator with the same key and x as bbs */
+static rndbbs_t *clone_bbs(rndbbs_t *bbs)
+{
+  rndbbs_t *c;
+
+  if ( (c = rndbbs_new()) == NULL )
+    return(NULL);
+
+  mpz_set(c->blumint, bbs->blumint);
+  mpz_set(c->p, bbs->p);
+  mpz_set(c->q, bbs->q);
+  mpz_set(c->x, bbs->x);
+  c->key_bitlen = bbs->key_bitlen;
+  c->improved = bbs->improved;
+  c->profile = bbs->profile;
+
+  return(c);
+}
+
+/*
+  claim segments until none are left, keystream into out, XOR in on top.
+    a thread that gets consecutive segments is already at the right x.
+*/
+static void *cipher_worker(void *arg)
+{
+  cipher_job_t *job = (cipher_job_t *) arg;
+  rndbbs_t *c;
+  uint64_t s, at = (uint64_t) -1;
+
+  if ( (c = clone_bbs(job->bbs)) == NULL )
+    {
+      job->failed = 1;
+      return(NULL);
+    }
+
+  while ( !job->failed &&
+	  ((s = __sync_fetch_and_add(&job->next, 1)) < job->nsegs) )
+    {
+      uint64_t off = s * RNDBBS_CIPHER_SEGMENT;
+      size_t i, n = RNDBBS_CIPHER_SEGMENT;
+      unsigned char *out = job->out + off;
+      const unsigned char *in = job->in + off;
+
+      if (job->length - off < n)
+	n = job->length - off;
+
+      if (s != at)
+	{
+	  mpz_set(c->x, job->bbs->x);
+	  rndbbs_jump(c, s * job->seg_squarings);
+	}
+
+      if (!rndbbs_fillbytes(c, out, n))
+	{
+	  job->failed = 1;
+	  break;
+	}
+      for (i=0;i<n;i++)
+	out[i] ^= in[i];
+
+      at = s + 1;
+    }
+
+  pthread_mutex_lock(&job->lock);
+  job->bbs->stats.squarings += c->stats.squarings;
+  job->bbs->stats.bits_extracted += c->stats.bits_extracted;
+  job->bbs->stats.bits_discarded += c->stats.bits_discarded;
+  job->bbs->stats.ns_generate += c->stats.ns_generate;
+  job->bbs->stats.ns_square += c->stats.ns_square;
+  pthread_mutex_unlock(&job->lock);
+
+  rndbbs_destroy(c);
+  return(NULL);
+}
+
+/* XOR length bytes of in with the keystream from bbs->x, into out */
+static int cipher_run(rndbbs_t *bbs, const unsigned char *in,
+		      unsigned char *out, uint64_t length,
+		      unsigned int nthreads)
+#define FUNC_NAME "cipher_run"
+{
+  cipher_job_t job;
+  pthread_t *tid;
+  unsigned int i, started;
+
+  job.bbs = bbs;
+  job.in = in;
+  job.out = out;
+  job.length = length;
+  job.nsegs = (length + RNDBBS_CIPHER_SEGMENT - 1) / RNDBBS_CIPHER_SEGMENT;
+  job.seg_squarings = rndbbs_squarings(bbs, RNDBBS_CIPHER_SEGMENT);
+  job.next = 0;
+  job.failed = 0;
+
+  if (job.nsegs == 0)
+    return(1);
+
+  if (nthreads == 0)
+    {
+      long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+      nthreads = (ncpu > 0) ? ncpu : 1;
+    }
+  if (nthreads > job.nsegs)
+    nthreads = job.nsegs;
+
+  if ( (tid = (pthread_t *) malloc(nthreads * sizeof(pthread_t))) == NULL )
+    {
+      perror(FUNC_NAME ": malloc");
+      return(0);
+    }
+  pthread_mutex_init(&job.lock, NULL);
+
+  for (started=0;started<nthreads;started++)
+    if (pthread_create(&tid[started], NULL, cipher_worker, &job) != 0)
+      {
+	perror(FUNC_NAME ": pthread_create");
+	break;
+      }
+  /* with at least one thread running, the work still gets done */
+  if (started == 0)
+    job.failed = 1;
+
+  for (i=0;i<started;i++)
+    pthread_join(tid[i], NULL);
+
+  pthread_mutex_destroy(&job.lock);
+  free(tid);
+
+  return(!job.failed);
+}
+#undef FUNC_NAME
+
+/* t+1: the squarings for all the segments of length bytes, plus one */
+static uint64_t cipher_squarings(rndbbs_t *bbs, uint64_t length)
+{
+  uint64_t nsegs;
+
+  if (length == 0)
+    return(1);
+
+  nsegs = (length - 1) / RNDBBS_CIPHER_SEGMENT;
+  return( nsegs * rndbbs_squarings(bbs, RNDBBS_CIPHER_SEGMENT) +
+	  rndbbs_squarings(bbs, length - nsegs * RNDBBS_CIPHER_SEGMENT) + 1 );
+}
+
+/* map all of fn read-only, *length = its size, *st = its fstat() */
+static int map_input(const char *fn, const unsigned char **map,
+		     uint64_t *length, struct stat *st)
+#define FUNC_NAME "map_input"
+{
+  int fd;
+
+  if ( (fd = open(fn, O_RDONLY)) == -1 )
+    {
+      perror(FUNC_NAME ": open");
+      return(0);
+    }
+  if (fstat(fd, st) == -1)
+    {
+      perror(FUNC_NAME ": fstat");
+      close(fd);
+      return(0);
+    }
+  if ( (uint64_t) st->st_size > (size_t) -1 )
+    {
+      fprintf(stderr, FUNC_NAME ": %s: too large to map\n", fn);
+      close(fd);
+      return(0);
+    }
+
+  *length = st->st_size;
+  *map = NULL;
+  if (*length > 0)
+    {
+      void *m = mmap(NULL, *length, PROT_READ, MAP_SHARED, fd, 0);
+
+      if (m == MAP_FAILED)
+	{
+	  perror(FUNC_NAME ": mmap");
+	  close(fd);
+	  return(0);
+	}
+      madvise(m, *length, MADV_SEQUENTIAL);
+      *map = (const unsigned char *) m;
+    }
+
+  close(fd);
+  return(1);
+}
+#undef FUNC_NAME
+
+/*
+  open fn for writing and empty it, unless it is the input file (in_st):
+    truncating that would destroy the data we are about to read.
+*/
+static int open_output(const char *fn, const struct stat *in_st)
+#define FUNC_NAME "open_output"
+{
+  struct stat st;
+  int fd;
+
+  if ( (fd = open(fn, O_RDWR|O_CREAT, 0666)) == -1 )
+    {
+      perror(FUNC_NAME ": open");
+      return(-1);
+    }
+  if (fstat(fd, &st) == -1)
+    {
+      perror(FUNC_NAME ": fstat");
+      close(fd);
+      return(-1);
+    }
+  if ( (st.st_dev == in_st->st_dev) && (st.st_ino == in_st->st_ino) )
+    {
+      fprintf(stderr, FUNC_NAME ": %s: is the input file\n", fn);
+      close(fd);
+      return(-1);
+    }
+  if ( S_ISREG(st.st_mode) && (ftruncate(fd, 0) == -1) )
+    {
+      perror(FUNC_NAME ": ftruncate");
+      close(fd);
+      return(-1);
+    }
+
+  return(fd);
+}
+#undef FUNC_NAME
+
+/* create fn (not the input file) with length bytes on disk, map it read-write */
+static int map_output(const char *fn, unsigned char **map, uint64_t length,
+		      const struct stat *in_st)
+#define FUNC_NAME "map_output"
+{
+  void *m;
+  int fd, err;
+
+  if ( length > (size_t) -1 )
+    {
+      fprintf(stderr, FUNC_NAME ": %s: too large to map\n", fn);
+      return(0);
+    }
+  if ( (fd = open_output(fn, in_st)) == -1 )
+    return(0);
+  if (ftruncate(fd, length) == -1)
+    {
+      perror(FUNC_NAME ": ftruncate");
+      close(fd);
+      return(0);
+    }
+  /* reserve the blocks now: a full disk is an error here,
+     and not a SIGBUS halfway through writing the map */
+  if ( ((err = posix_fallocate(fd, 0, length)) != 0) && (err != EOPNOTSUPP) )
+    {
+      errno = err;
+      perror(FUNC_NAME ": posix_fallocate");
+      if (ftruncate(fd, 0) == -1)
+	perror(FUNC_NAME ": ftruncate");
+      close(fd);
+      return(0);
+    }
+
+  m = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED)
+    {
+      perror(FUNC_NAME ": mmap");
+      return(0);
+    }
+
+  *map = (unsigned char *) m;
+  return(1);
+}
+#undef FUNC_NAME
+
+static int unmap(void *map, uint64_t length)
+#define FUNC_NAME "unmap"
+{
+  if (map == NULL)
+    return(1);
+
+  if (munmap(map, length) == -1)
+    {
+      perror(FUNC_NAME ": munmap");
+      return(0);
+    }
+
+  return(1);
+}
+#undef FUNC_NAME
+
+/*
+  encrypt in_fn to out_fn, starting from bbs->x as x[0] (so key bbs and
+    rndbbs_gen_x() it first; never reuse an x[0] with the same key).
+    nthreads 0 means one per online CPU.
+*/
+int rndbbs_encrypt_file(rndbbs_t *bbs, const char *in_fn, const char *out_fn,
+			unsigned int nthreads)
+#define FUNC_NAME "rndbbs_encrypt_file"
+{
+  const unsigned char *in;
+  unsigned char *out;
+  struct stat in_st;
+  uint64_t length, nsq, total;
+  size_t klen = (bbs->key_bitlen + 7) / 8, count;
+  int ok;
+
+  if (bbs->xor_urandom)
+    {
+      fprintf(stderr, FUNC_NAME ": can't decrypt urandom whitened output\n");
+      return(0);
+    }
+
+  if (!map_input(in_fn, &in, &length, &in_st))
+    return(0);
+  total = RNDBBS_CIPHER_HDRLEN + klen + length;
+  if (!map_output(out_fn, &out, total, &in_st))
+    {
+      unmap((void *) in, length);
+      return(0);
+    }
+
+  ok = cipher_run(bbs, in, out + RNDBBS_CIPHER_HDRLEN + klen, length,
+		  nthreads);
+
+  if (ok)
+    {
+      mpz_t x0;
+
+      nsq = cipher_squarings(bbs, length);
+      mpz_init_set(x0, bbs->x);
+      rndbbs_jump(bbs, nsq);
+
+      memcpy(out, RNDBBS_CIPHER_MAGIC, 8);
+      put_le(out + 8, bbs->improved ? RNDBBS_CIPHER_IMPROVED : 0, 4);
+      put_le(out + 12, bbs->key_bitlen, 4);
+      put_le(out + 16, length, 8);
+      put_le(out + 24, RNDBBS_CIPHER_SEGMENT, 8);
+      put_le(out + 32, nsq, 8);
+      put_le(out + 40, keycheck(bbs), 8);
+      memset(out + RNDBBS_CIPHER_HDRLEN, 0, klen);
+      count = (mpz_sizeinbase(bbs->x, 2) + 7) / 8;
+      mpz_export(out + RNDBBS_CIPHER_HDRLEN + klen - count, NULL,
+		 1, 1, 1, 0, bbs->x);
+
+      mpz_swap(bbs->x, x0);
+      mpz_clear(x0);
+    }
+
+  unmap((void *) in, length);
+  if (!unmap(out, total))
+    ok = 0;
+  if (!ok)
+    unlink(out_fn);
+
+  return(ok);
+}
+#undef FUNC_NAME
+
+/* decrypt in_fn (from rndbbs_encrypt_file()) to out_fn, bbs has the key */
+int rndbbs_decrypt_file(rndbbs_t *bbs, const char *in_fn, const char *out_fn,
+			unsigned int nthreads)
+#define FUNC_NAME "rndbbs_decrypt_file"
+{
+  const unsigned char *in;
+  unsigned char *out;
+  struct stat in_st;
+  uint64_t inlen, length;
+  size_t klen = (bbs->key_bitlen + 7) / 8;
+  int improved = bbs->improved, ok;
+
+  if ( (mpz_sgn(bbs->p) == 0) || (mpz_sgn(bbs->q) == 0) )
+    {
+      fprintf(stderr, FUNC_NAME ": need the factors of the key\n");
+      return(0);
+    }
+
+  if (!map_input(in_fn, &in, &inlen, &in_st))
+    return(0);
+
+  if ( (inlen < RNDBBS_CIPHER_HDRLEN + klen) ||
+       (memcmp(in, RNDBBS_CIPHER_MAGIC, 8) != 0) )
+    {
+      fprintf(stderr, FUNC_NAME ": %s: not an encrypted file\n", in_fn);
+      unmap((void *) in, inlen);
+      return(0);
+    }
+  if ( (get_le(in + 12, 4) != bbs->key_bitlen) ||
+       (get_le(in + 40, 8) != keycheck(bbs)) )
+    {
+      fprintf(stderr, FUNC_NAME ": %s: encrypted with another key\n", in_fn);
+      unmap((void *) in, inlen);
+      return(0);
+    }
+
+  length = get_le(in + 16, 8);
+  if ( (get_le(in + 24, 8) != RNDBBS_CIPHER_SEGMENT) ||
+       (length != inlen - RNDBBS_CIPHER_HDRLEN - klen) )
+    {
+      fprintf(stderr, FUNC_NAME ": %s: bad header\n", in_fn);
+      unmap((void *) in, inlen);
+      return(0);
+    }
+
+  bbs->improved = (get_le(in + 8, 4) & RNDBBS_CIPHER_IMPROVED) != 0;
+  if (get_le(in + 32, 8) != cipher_squarings(bbs, length))
+    {
+      fprintf(stderr, FUNC_NAME ": %s: bad header\n", in_fn);
+      bbs->improved = improved;
+      unmap((void *) in, inlen);
+      return(0);
+    }
+
+  /* x[0] from x[t+1] */
+  mpz_import(bbs->x, klen, 1, 1, 1, 0, in + RNDBBS_CIPHER_HDRLEN);
+  rndbbs_rewind(bbs, get_le(in + 32, 8));
+
+  if (length == 0)
+    {
+      /* nothing to map, but the file should still exist */
+      int fd = open_output(out_fn, &in_st);
+
+      if ( (ok = (fd != -1)) )
+	close(fd);
+    }
+  else if ( (ok = map_output(out_fn, &out, length, &in_st)) )
+    {
+      ok = cipher_run(bbs, in + RNDBBS_CIPHER_HDRLEN + klen, out, length,
+		      nthreads);
+      if (!unmap(out, length))
+	ok = 0;
+      /* don't leave half decrypted data around */
+      if (!ok)
+	unlink(out_fn);
+    }
+
+  bbs->improved = improved;
+  unmap((void *) in, inlen);
+
+  return(ok);
+}
+#undef FUNC_NAME
@@ -98,6 +98,106 @@ int _urandread(unsigned char *rndbuf, size_t nbytes)
 #undef FUNC_NAME
 #endif
 
+/* monotonic clock for rndbbs_stats_t, in nanoseconds */
+static unsigned long long _rndbbs_nsec(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER freq, count;
+
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return( (count.QuadPart / freq.QuadPart) * 1000000000ULL +
+	  (count.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart );
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return( ts.tv_sec * 1000000000ULL + ts.tv_nsec );
+#endif
+}
+
+/* _hwrandread(), accounted in bbs->stats */
+static int _rndbbs_entropy(rndbbs_t *bbs, unsigned char *rndbuf, size_t nbytes)
+{
+  unsigned long long t0 = _rndbbs_nsec();
+  int nread = _hwrandread(rndbuf, nbytes);
+
+  bbs->stats.ns_entropy += _rndbbs_nsec() - t0;
+  if (nread > 0)
+    bbs->stats.entropy_bytes += nread;
+
+  return(nread);
+}
+
+/*
+  bits kept per squaring by the improved generator, floor(log2(key_bitlen)).
+    integer only; matches the double log() version for every key length
+    up to 2^20 bits.
+*/
+static inline unsigned int _rndbbs_loglog(rndbbs_t *bbs)
+{
+  size_t k = bbs->key_bitlen;
+  unsigned int l = 0;
+
+  while (k >>= 1)
+    l++;
+
+  return(l);
+}
+
+#ifdef GMPBBS_MINI_GMP
+/*
+  mini-gmp has no mpz_nextprime(): the next odd number passing one
+    Miller-Rabin round (after mini-gmp's small factor checks).
+    rndbbs_gen_blumint() tests the ones it keeps properly anyway.
+*/
+static void _rndbbs_nextprime(mpz_t r, const mpz_t n)
+{
+  mpz_add_ui(r, n, 1);
+  if (mpz_cmp_ui(r, 2) <= 0)
+    {
+      mpz_set_ui(r, 2);
+      return;
+    }
+  if (!mpz_tstbit(r, 0))
+    mpz_add_ui(r, r, 1);
+  while (!mpz_probab_prime_p(r, 1))
+    mpz_add_ui(r, r, 2);
+}
+#else
+#define _rndbbs_nextprime(r, n) mpz_nextprime(r, n)
+#endif
+
+/* x[n+1] = x[n]^2 (mod blumint), timed separately only when profiling */
+static inline void _rndbbs_square(rndbbs_t *bbs)
+{
+  if (bbs->profile)
+    {
+      unsigned long long t0 = _rndbbs_nsec();
+
+      mpz_powm_ui(bbs->x, bbs->x, 2, bbs->blumint);
+      bbs->stats.ns_square += _rndbbs_nsec() - t0;
+    }
+  else
+    mpz_powm_ui(bbs->x, bbs->x, 2, bbs->blumint);
+
+  bbs->stats.squarings++;
+}
+
+/*
+  forget the bits held back from an old x: the tail kept by
+    rndbbs_fillbytes_partial() and the reservoir of rndbbs_randbits().
+    called wherever x is replaced, so what follows depends only on x.
+*/
+static void _rndbbs_drop_bits(rndbbs_t *bbs)
+{
+  bbs->carry_bit = -1;
+  bbs->res_pos = RNDBBS_RESERVOIR_WORDS;
+  bbs->res_left = 0;
+  bbs->res_acc = 0;
+  bbs->res_bits = 0;
+}
+
 /*
   initialize bbs->blumint randomly
     key_bitlen may be over by n=pq,
@@ -110,6 +210,7 @@ int rndbbs_gen_blumint (rndbbs_t *bbs, unsigned int key_bitlen)
 #define FUNC_NAME "rndbbs_gen_blumint"
 {
   mpz_t p, q;
+  unsigned long long t_start = _rndbbs_nsec(), t_prime;
 
   if (key_bitlen < GMPBBS_MINKEYLEN)
     return(0);
@@ -117,7 +218,7 @@ int rndbbs_gen_blumint (rndbbs_t *bbs, unsigned int key_bitlen)
   /* init pstr */
   {
     int i, pbits = (key_bitlen)/2 + 1;
-    int pbytes = ceil(pbits/8.0);
+    int pbytes = (pbits + 7) / 8;
     char *pstr;
     unsigned char *rnd;
 
@@ -128,7 +229,7 @@ int rndbbs_gen_blumint (rndbbs_t *bbs, unsigned int key_bitlen)
       }
 
     /* get random seed for p from random device */
-    if (_hwrandread(rnd, pbytes) != pbytes)
+    if (_rndbbs_entropy(bbs, rnd, pbytes) != pbytes)
       {
 	free(rnd);
 	perror(FUNC_NAME ": _hwrandread");
@@ -165,22 +266,28 @@ int rndbbs_gen_blumint (rndbbs_t *bbs, unsigned int key_bitlen)
     free(pstr);
 
     /* now, find p such that ( p prime ) && ( p = 3 (mod 4) ) */
+    t_prime = _rndbbs_nsec();
     for(;;)
       {
-	mpz_nextprime(p,p);
+	_rndbbs_nextprime(p,p);
+	bbs->stats.prime_candidates++;
 
 	/* mpz_tstbit(p, 1) (p!=2) is faster than mpz_fdiv_ui(p, 4)==3 */
-	if ( mpz_tstbit(p, 1) &&
-	     /* probab_prime: mainly to do an advanced check (higher REPS) */
-	     mpz_probab_prime_p(p, MPZ_PROBAB_PRIME_REPS) )
+	if ( !mpz_tstbit(p, 1) )
+	  continue;
+
+	/* probab_prime: mainly to do an advanced check (higher REPS) */
+	bbs->stats.prime_tests++;
+	if ( mpz_probab_prime_p(p, MPZ_PROBAB_PRIME_REPS) )
 	  break;
       }
+    bbs->stats.ns_prime += _rndbbs_nsec() - t_prime;
   }
 
   /* init qstr */
   {
     int i, qbits = (key_bitlen)/2 + (key_bitlen%2);
-    int qbytes = ceil(qbits/8.0);
+    int qbytes = (qbits + 7) / 8;
 
     char *qstr;
     unsigned char *rnd;
@@ -192,7 +299,7 @@ int rndbbs_gen_blumint (rndbbs_t *bbs, unsigned int key_bitlen)
       }
 
     /* get random seed for q from random device */
-    if (_hwrandread(rnd, qbytes) != qbytes)
+    if (_rndbbs_entropy(bbs, rnd, qbytes) != qbytes)
       {
 	free(rnd);
 	perror(FUNC_NAME ": _hwrandread");
@@ -229,15 +336,21 @@ int rndbbs_gen_blumint (rndbbs_t *bbs, unsigned int key_bitlen)
     free(qstr);
 
     /* now, find q such that ( q prime ) && ( q = 3 (mod 4) ) */
+    t_prime = _rndbbs_nsec();
     for(;;)
       {
-	mpz_nextprime(q,q);
+	_rndbbs_nextprime(q,q);
+	bbs->stats.prime_candidates++;
 	/* mpz_tstbit(q, 1) (q!=2) is faster than mpz_fdiv_ui(q, 4)==3 */
-	if ( mpz_tstbit(q, 1) &&
-	     /* probab_prime: mainly to do an advanced check (higher REPS) */
-	     mpz_probab_prime_p(q, MPZ_PROBAB_PRIME_REPS) )
+	if ( !mpz_tstbit(q, 1) )
+	  continue;
+
+	/* probab_prime: mainly to do an advanced check (higher REPS) */
+	bbs->stats.prime_tests++;
+	if ( mpz_probab_prime_p(q, MPZ_PROBAB_PRIME_REPS) )
 	  break;
       }
+    bbs->stats.ns_prime += _rndbbs_nsec() - t_prime;
   }
 
   /* a blum integer is p*q ( p and q both = 3 (mod 4) ) */
@@ -246,11 +359,14 @@ int rndbbs_gen_blumint (rndbbs_t *bbs, unsigned int key_bitlen)
   /* we need this later to find how many bits ( log2(bbs->key_bitlen) ) */
   bbs->key_bitlen = mpz_sizeinbase(bbs->blumint, 2);
 
-  /* we want p,q if we're going to use this as a stream cipher */
-  
+  /* keep p,q: rndbbs_jump() and rndbbs_rewind() need them */
+  mpz_swap(bbs->p, p);
+  mpz_swap(bbs->q, q);
   mpz_clear(p);
   mpz_clear(q);
-  
+
+  bbs->stats.ns_keygen += _rndbbs_nsec() - t_start;
+
   return(1);
 }
 #undef FUNC_NAME
@@ -262,6 +378,7 @@ int rndbbs_gen_x (rndbbs_t *bbs)
   unsigned char *rnd;
   char *xstr;
   int i, nbytes = (mpz_sizeinbase(bbs->blumint, 2)+7)/8;
+  unsigned long long t_start = _rndbbs_nsec();
 
   if ( (rnd = (unsigned char *) malloc(nbytes)) == NULL )
     {
@@ -270,7 +387,7 @@ int rndbbs_gen_x (rndbbs_t *bbs)
     }
 
   /* get random seed for x from random device */
-  if (_hwrandread(rnd, nbytes) != nbytes)
+  if (_rndbbs_entropy(bbs, rnd, nbytes) != nbytes)
     {
       free(rnd);
       perror(FUNC_NAME ": _hwrandread");
@@ -314,11 +431,50 @@ int rndbbs_gen_x (rndbbs_t *bbs)
 
   /* x[0] = x^2 (mod blumint) */
   mpz_powm_ui(bbs->x, bbs->x, 2, bbs->blumint);
+  _rndbbs_drop_bits(bbs);
+
+  bbs->stats.ns_seed += _rndbbs_nsec() - t_start;
 
   return(1);
 }
 #undef FUNC_NAME
 
+/* key with given primes p, q ( both prime and = 3 (mod 4) ) */
+int rndbbs_set_key(rndbbs_t *bbs, const mpz_t p, const mpz_t q)
+{
+  if ( !mpz_probab_prime_p(p, MPZ_PROBAB_PRIME_REPS) || !mpz_tstbit(p, 1) ||
+       !mpz_probab_prime_p(q, MPZ_PROBAB_PRIME_REPS) || !mpz_tstbit(q, 1) ||
+       (mpz_cmp(p, q) == 0) )
+    return(0);
+
+  mpz_set(bbs->p, p);
+  mpz_set(bbs->q, q);
+  mpz_mul(bbs->blumint, p, q);
+  bbs->key_bitlen = mpz_sizeinbase(bbs->blumint, 2);
+
+  return(1);
+}
+
+/* x[0] = x^2 (mod blumint) for a given x, gcd(blumint,x) must be 1 */
+int rndbbs_set_x(rndbbs_t *bbs, const mpz_t x)
+{
+  mpz_t tmpgcd;
+  int ok;
+
+  mpz_init(tmpgcd);
+  mpz_gcd(tmpgcd, bbs->blumint, x);
+  ok = (mpz_cmp_ui(tmpgcd, 1) == 0);
+  mpz_clear(tmpgcd);
+
+  if (ok)
+    {
+      mpz_powm_ui(bbs->x, x, 2, bbs->blumint);
+      _rndbbs_drop_bits(bbs);
+    }
+
+  return(ok);
+}
+
 rndbbs_t *rndbbs_new()
 #define FUNC_NAME "rndbbs_new"
 {
@@ -331,10 +487,17 @@ rndbbs_t *rndbbs_new()
     }
 
   mpz_init(bbs->blumint);
+  mpz_init(bbs->p);
+  mpz_init(bbs->q);
   mpz_init(bbs->x);
   bbs->key_bitlen = 0;
   bbs->improved = 1;
   bbs->xor_urandom = 0;
+  bbs->profile = 0;
+  bbs->health = NULL;
+  bbs->res_buf = NULL;
+  _rndbbs_drop_bits(bbs);
+  memset(&bbs->stats, 0, sizeof(bbs->stats));
 
   return(bbs);
 }
@@ -343,98 +506,132 @@ rndbbs_t *rndbbs_new()
 int rndbbs_destroy(rndbbs_t *bbs)
 #define FUNC_NAME "rndbbs_destroy"
 {
-  /* if using this as a cipher, we need to append xn+1 to the end. */
   mpz_clear(bbs->blumint);
+  mpz_clear(bbs->p);
+  mpz_clear(bbs->q);
   mpz_clear(bbs->x);
+  free(bbs->res_buf);
   free(bbs);
 
   return(1);
 }
 #undef FUNC_NAME
 
-char *rndbbs_randbytes(rndbbs_t *bbs, size_t nbytes)
-#define FUNC_NAME "rndbbs_randbytes"
+/*
+  the generator proper, see rndbbs_fillbytes().
+    with xor_urandom the buffer is first filled from the urandom device,
+    and the BBS bits are XORed on top of it.
+    with partial set, the unused bits of the last x are left for the
+    next call (bbs->carry_bit) instead of being thrown away.
+*/
+static int _rndbbs_generate(rndbbs_t *bbs, unsigned char *buf, size_t nbytes,
+			    int partial)
+#define FUNC_NAME "_rndbbs_generate"
 {
-  char *retbuf;
-  char *urandom_buffer = NULL;
-
-  if ( (retbuf = (char *) malloc(nbytes)) == NULL)
-    {
-      perror(FUNC_NAME ": malloc");
-      return(NULL);
-    }
+  int do_xor = 0;
+  unsigned long long t_start = _rndbbs_nsec();
 
   if ( bbs->xor_urandom )
     {
-      if ( (urandom_buffer = (char *) malloc(nbytes)) == NULL)
-	{
-	  perror(FUNC_NAME ": malloc");
-	  return(NULL);
-	}
-
-      if ( _urandread((unsigned char *) urandom_buffer, nbytes) != nbytes )
+      if ( _urandread(buf, nbytes) != nbytes )
 	{
 	  perror(FUNC_NAME ": _urandread: continuting...");
 	  bbs->xor_urandom = 0;
 	}
-    }
+      else
+	{
+	  do_xor = 1;
+	  bbs->stats.whiten_bytes += nbytes;
+	}
 
-  memset(retbuf, 0, nbytes);
+      /* the XOR itself is folded into the bit packing below */
+      bbs->stats.ns_whiten += _rndbbs_nsec() - t_start;
+      t_start = _rndbbs_nsec();
+    }
 
   if (!bbs->improved)
     {
       /* basic implementation without improvements (only keep parity) */
-      {
-	int i;
-	for (i=0;i<nbytes;i++)
-	  {
-	    int j;
-
-	    /* we keep the parity (least significant bit) of each x_n */
-	    for (j=7;j>=0;j--)
-	      {
-		/* x[n+1] = x[n]^2 (mod blumint) */
-		mpz_powm_ui(bbs->x, bbs->x, 2, bbs->blumint);
-
-		/* mpz_fdiv_ui(bbs->x, 2) == mpz_tstbit(bbs->x, 0) */
-		retbuf[i] |= (mpz_tstbit(bbs->x, 0) << j);
-	      }
-	    if (bbs->xor_urandom)
-	      retbuf[i] ^= urandom_buffer[i];
-	  }
-	if ( urandom_buffer != NULL )
-	  free(urandom_buffer);
-	return(retbuf);
-      }
+      size_t i;
+
+      for (i=0;i<nbytes;i++)
+	{
+	  unsigned char c = 0;
+	  int j;
+
+	  /* we keep the parity (least significant bit) of each x_n */
+	  for (j=7;j>=0;j--)
+	    {
+	      /* x[n+1] = x[n]^2 (mod blumint) */
+	      _rndbbs_square(bbs);
+
+	      /* mpz_fdiv_ui(bbs->x, 2) == mpz_tstbit(bbs->x, 0) */
+	      c |= (mpz_tstbit(bbs->x, 0) << j);
+	    }
+	  if (do_xor)
+	    buf[i] ^= c;
+	  else
+	    buf[i] = c;
+	}
+
+      bbs->stats.bits_extracted += 8 * (unsigned long long) nbytes;
+      bbs->stats.ns_generate += _rndbbs_nsec() - t_start;
+      return(1);
     }
   else
     {
       /* improved implementation (keep log2(log2(blumint)) bits of x[i]) */
-      unsigned int loglogblum = log(1.0*bbs->key_bitlen)/log(2.0);
+      unsigned int loglogblum = _rndbbs_loglog(bbs);
 
-      unsigned int byte=0, bit=0, i;
+      unsigned int bit=0, i;
+      size_t byte=0;
+      unsigned char c = 0;
+      int carry = bbs->carry_bit;
 
       for (;;)
 	{
-	  /* x[n+1] = x[n]^2 (mod blumint) */
-	  mpz_powm_ui(bbs->x, bbs->x, 2, bbs->blumint);
+	  if (carry >= 0)
+	    {
+	      /* the rest of x from the last (partial) call */
+	      i = carry;
+	      carry = -1;
+	    }
+	  else
+	    {
+	      /* x[n+1] = x[n]^2 (mod blumint) */
+	      _rndbbs_square(bbs);
+	      i = 0;
+	    }
 
-	  for (i=0;i<loglogblum;i++)
+	  for (;i<loglogblum;i++)
 	    {
 	      if (byte == nbytes)
 		{
-		  if ( urandom_buffer != NULL )
-		    free(urandom_buffer);
-		  return(retbuf);
+		  bbs->stats.bits_extracted += 8 * (unsigned long long) nbytes;
+		  if (partial)
+		    {
+		      bbs->carry_bit = i;
+		    }
+		  else
+		    {
+		      /* the rest of this x is never handed out */
+		      bbs->carry_bit = -1;
+		      bbs->stats.bits_discarded += loglogblum - i;
+		    }
+		  bbs->stats.ns_generate += _rndbbs_nsec() - t_start;
+		  return(1);
 		}
 
 	      /* get the ith bit of x */
-	      retbuf[byte] |= (mpz_tstbit(bbs->x, i) << (7-bit) );
+	      c |= (mpz_tstbit(bbs->x, i) << (7-bit) );
 
 	      if (bit == 7)
 		{
-		  if (bbs->xor_urandom)
-		    retbuf[byte] ^= urandom_buffer[byte];
+		  if (do_xor)
+		    buf[byte] ^= c;
+		  else
+		    buf[byte] = c;
+		  c = 0;
 		  byte++;
 		  bit=0;
 		}
@@ -448,6 +645,77 @@ char *rndbbs_randbytes(rndbbs_t *bbs, size_t nbytes)
 }
 #undef FUNC_NAME
 
+/*
+  fill a caller supplied buffer with nbytes of BBS output.
+    this is the allocation-free core of rndbbs_randbytes(),
+    for callers that keep their own buffers (gmpbbsd, ...).
+    if a health checker is attached, everything handed out goes through it,
+    and we refuse to hand out more once it has failed.
+*/
+static int _rndbbs_fillbytes(rndbbs_t *bbs, unsigned char *buf,
+			     size_t nbytes, int partial)
+#define FUNC_NAME "rndbbs_fillbytes"
+{
+  if (!_rndbbs_generate(bbs, buf, nbytes, partial))
+    return(0);
+
+  if ( (bbs->health != NULL) &&
+       !rndbbs_health_feed(bbs->health, buf, nbytes) )
+    {
+      fprintf(stderr, FUNC_NAME ": health check failed\n");
+      return(0);
+    }
+
+  return(1);
+}
+#undef FUNC_NAME
+
+int rndbbs_fillbytes(rndbbs_t *bbs, unsigned char *buf, size_t nbytes)
+{
+  return(_rndbbs_fillbytes(bbs, buf, nbytes, 0));
+}
+
+/*
+  like rndbbs_fillbytes(), but what is left of the last x is kept for
+    the next call.  any number of these followed by one rndbbs_fillbytes()
+    give exactly the bytes one rndbbs_fillbytes() of the total would,
+    so big requests can go through a small buffer.
+*/
+int rndbbs_fillbytes_partial(rndbbs_t *bbs, unsigned char *buf,
+			     size_t nbytes)
+{
+  return(_rndbbs_fillbytes(bbs, buf, nbytes, 1));
+}
+
+/* copy out the counters and timers gathered so far */
+int rndbbs_get_stats(rndbbs_t *bbs, rndbbs_stats_t *stats)
+{
+  memcpy(stats, &bbs->stats, sizeof(rndbbs_stats_t));
+
+  return(1);
+}
+
+char *rndbbs_randbytes(rndbbs_t *bbs, size_t nbytes)
+#define FUNC_NAME "rndbbs_randbytes"
+{
+  char *retbuf;
+
+  if ( (retbuf = (char *) malloc(nbytes)) == NULL)
+    {
+      perror(FUNC_NAME ": malloc");
+      return(NULL);
+    }
+
+  if (!rndbbs_fillbytes(bbs, (unsigned char *) retbuf, nbytes))
+    {
+      free(retbuf);
+      return(NULL);
+    }
+
+  return(retbuf);
+}
+#undef FUNC_NAME
+
 unsigned int *rndbbs_randint(rndbbs_t *bbs, unsigned int base, size_t nmemb)
 #define FUNC_NAME "rndbbs_randint"
 {
@@ -460,7 +728,8 @@ unsigned int *rndbbs_randint(rndbbs_t *bbs, unsigned int base, size_t nmemb)
   /* we waste a few precious bits here unless we're a power of 256 */
   unsigned int nbytes = ceil((nmemb)*log(base)/log(256));
 
-  rndbuf = (unsigned char *) rndbbs_randbytes(bbs, nbytes);
+  if ( (rndbuf = (unsigned char *) rndbbs_randbytes(bbs, nbytes)) == NULL )
+    return(NULL);
 
   if ( (mpzstr = (char *) malloc(2*nbytes+1)) == NULL)
     {
@@ -512,3 +781,255 @@ unsigned int *rndbbs_randint(rndbbs_t *bbs, unsigned int base, size_t nmemb)
   return(rndint);
 }
 #undef FUNC_NAME
+
+/*
+  fill out[] with nmemb values of `bits' (1..64) bits each.
+    bits come from the reservoir in bbs, so no output is wasted
+    between calls: 53 bits for a double cost 53 bits, not 64.
+*/
+#define RESERVOIR_BYTES (RNDBBS_RESERVOIR_WORDS * sizeof(uint64_t))
+
+int rndbbs_randbits(rndbbs_t *bbs, uint64_t *out, size_t nmemb,
+		    unsigned int bits)
+#define FUNC_NAME "rndbbs_randbits"
+{
+  uint64_t mask;
+  uint64_t acc = bbs->res_acc;
+  unsigned int nacc = bbs->res_bits;
+  size_t i, pos = bbs->res_pos;
+  int ret = 1;
+
+  if ( (bits < 1) || (bits > 64) )
+    return(0);
+  mask = (bits == 64) ? ~0ULL : ( (1ULL << bits) - 1 );
+
+  if ( (bbs->res_buf == NULL) &&
+       ((bbs->res_buf = (uint64_t *) malloc(RESERVOIR_BYTES)) == NULL) )
+    {
+      perror(FUNC_NAME ": malloc");
+      return(0);
+    }
+
+  for (i=0;i<nmemb;i++)
+    {
+      uint64_t w;
+      unsigned int used;
+
+      if (nacc >= bits)
+	{
+	  out[i] = acc & mask;
+	  acc = (bits == 64) ? 0 : (acc >> bits);
+	  nacc -= bits;
+	  continue;
+	}
+
+      if (pos == RNDBBS_RESERVOIR_WORDS)
+	{
+	  int ok;
+
+	  /* one RNDBBS_RESERVOIR_CALL, a reservoir at a time */
+	  if (bbs->res_left == 0)
+	    bbs->res_left = RNDBBS_RESERVOIR_CALL;
+	  bbs->res_left -= RESERVOIR_BYTES;
+	  if (bbs->res_left == 0)
+	    ok = rndbbs_fillbytes(bbs, (unsigned char *) bbs->res_buf,
+				  RESERVOIR_BYTES);
+	  else
+	    ok = rndbbs_fillbytes_partial(bbs, (unsigned char *) bbs->res_buf,
+					  RESERVOIR_BYTES);
+	  if (!ok)
+	    {
+	      ret = 0;
+	      break;
+	    }
+	  pos = 0;
+	}
+
+      /* the low nacc bits are left over, the rest come from a new word */
+      w = bbs->res_buf[pos++];
+      used = bits - nacc;
+      out[i] = (acc | (w << nacc)) & mask;
+      acc = (used == 64) ? 0 : (w >> used);
+      nacc = 64 - used;
+    }
+
+  bbs->res_acc = acc;
+  bbs->res_bits = nacc;
+  bbs->res_pos = pos;
+
+  return(ret);
+}
+#undef FUNC_NAME
+
+/* values converted per rndbbs_randbits() call, sized for the stack */
+#define RAND_FP_CHUNK 256
+
+/*
+  uniform doubles in [0,1): 53 random bits, scaled by 2^-53.
+    the conversion is a separate pass over a chunk so the compiler
+    can vectorize it.
+*/
+int rndbbs_rand_double(rndbbs_t *bbs, double *out, size_t nmemb)
+{
+  uint64_t tmp[RAND_FP_CHUNK];
+  size_t done = 0;
+
+  while (done < nmemb)
+    {
+      size_t i, n = nmemb - done;
+
+      if (n > RAND_FP_CHUNK)
+	n = RAND_FP_CHUNK;
+      if (!rndbbs_randbits(bbs, tmp, n, 53))
+	return(0);
+
+      /* < 2^53, so the signed conversion is exact */
+      for (i=0;i<n;i++)
+	out[done+i] = (double) (int64_t) tmp[i] * 0x1.0p-53;
+      done += n;
+    }
+
+  return(1);
+}
+
+/* uniform floats in [0,1): 24 random bits, scaled by 2^-24 */
+int rndbbs_rand_float(rndbbs_t *bbs, float *out, size_t nmemb)
+{
+  uint64_t tmp[RAND_FP_CHUNK];
+  size_t done = 0;
+
+  while (done < nmemb)
+    {
+      size_t i, n = nmemb - done;
+
+      if (n > RAND_FP_CHUNK)
+	n = RAND_FP_CHUNK;
+      if (!rndbbs_randbits(bbs, tmp, n, 24))
+	return(0);
+
+      for (i=0;i<n;i++)
+	out[done+i] = (float) (int32_t) tmp[i] * 0x1.0p-24f;
+      done += n;
+    }
+
+  return(1);
+}
+
+#undef RAND_FP_CHUNK
+
+/* mpz_set_ui() only takes an unsigned long, 32 bits on some targets */
+static void _mpz_set_u64(mpz_t r, uint64_t v)
+{
+  mpz_set_ui(r, (unsigned long) (v >> 32));
+  mpz_mul_2exp(r, r, 32);
+  mpz_add_ui(r, r, (unsigned long) (v & 0xffffffffUL));
+}
+
+/*
+  the number of squarings rndbbs_fillbytes(bbs, buf, nbytes) does,
+    i.e. how far it moves bbs->x.  the improved generator squares once
+    more than the bits it needs, see _rndbbs_generate().
+*/
+uint64_t rndbbs_squarings(rndbbs_t *bbs, size_t nbytes)
+{
+  unsigned int loglogblum;
+
+  if (!bbs->improved)
+    return( 8 * (uint64_t) nbytes );
+
+  loglogblum = _rndbbs_loglog(bbs);
+  return( 8 * (uint64_t) nbytes / loglogblum + 1 );
+}
+
+/*
+  x[n] -> x[n+nsquarings] without squaring nsquarings times
+    (dropping the bits still held back from x[n]):
+    x[n+k] = x[n]^(2^k) and x[n]^lcm(p-1,q-1) = 1, so one
+    exponentiation by 2^k mod lcm(p-1,q-1) does it.
+    without the factors we can only square our way there.
+*/
+int rndbbs_jump(rndbbs_t *bbs, uint64_t nsquarings)
+{
+  mpz_t lambda, e;
+
+  _rndbbs_drop_bits(bbs);
+  if ( (mpz_sgn(bbs->p) == 0) || (mpz_sgn(bbs->q) == 0) )
+    {
+      while (nsquarings-- > 0)
+	mpz_powm_ui(bbs->x, bbs->x, 2, bbs->blumint);
+      return(1);
+    }
+
+  mpz_init(lambda);
+  mpz_init(e);
+
+  mpz_sub_ui(lambda, bbs->p, 1);
+  mpz_sub_ui(e, bbs->q, 1);
+  mpz_lcm(lambda, lambda, e);
+
+  mpz_set_ui(e, 2);
+  {
+    mpz_t k;
+
+    mpz_init(k);
+    _mpz_set_u64(k, nsquarings);
+    mpz_powm(e, e, k, lambda);
+    mpz_clear(k);
+  }
+  mpz_powm(bbs->x, bbs->x, e, bbs->blumint);
+
+  mpz_clear(e);
+  mpz_clear(lambda);
+
+  return(1);
+}
+
+/*
+  x[n] -> x[n-nsquarings], needs the factors.
+    for p = 3 (mod 4) the one square root of a quadratic residue a that
+    is itself a residue is a^((p+1)/4) (mod p), so going back k steps
+    is a^(((p+1)/4)^k mod (p-1)) (mod p); the same mod q, then CRT.
+*/
+int rndbbs_rewind(rndbbs_t *bbs, uint64_t nsquarings)
+{
+  mpz_t k, e, rp, rq;
+
+  if ( (mpz_sgn(bbs->p) == 0) || (mpz_sgn(bbs->q) == 0) )
+    return(0);
+
+  mpz_init(k);
+  mpz_init(e);
+  mpz_init(rp);
+  mpz_init(rq);
+  _mpz_set_u64(k, nsquarings);
+
+  /* rp = x^(((p+1)/4)^k mod (p-1)) (mod p) */
+  mpz_add_ui(e, bbs->p, 1);
+  mpz_fdiv_q_2exp(e, e, 2);
+  mpz_sub_ui(rp, bbs->p, 1);
+  mpz_powm(e, e, k, rp);
+  mpz_powm(rp, bbs->x, e, bbs->p);
+
+  /* rq likewise */
+  mpz_add_ui(e, bbs->q, 1);
+  mpz_fdiv_q_2exp(e, e, 2);
+  mpz_sub_ui(rq, bbs->q, 1);
+  mpz_powm(e, e, k, rq);
+  mpz_powm(rq, bbs->x, e, bbs->q);
+
+  /* x = rp + p * ( (rq - rp) * p^-1 (mod q) ) */
+  mpz_invert(e, bbs->p, bbs->q);
+  mpz_sub(k, rq, rp);
+  mpz_mul(k, k, e);
+  mpz_mod(k, k, bbs->q);
+  mpz_mul(k, k, bbs->p);
+  mpz_add(bbs->x, k, rp);
+  _rndbbs_drop_bits(bbs);
+
+  mpz_clear(rq);
+  mpz_clear(rp);
+  mpz_clear(e);
+  mpz_clear(k);
+
+  return(1);
+}
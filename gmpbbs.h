@@ -30,8 +30,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <math.h> /* needed for rndbbs_randint() */
+#include <time.h> /* needed for rndbbs_stats_t */
+
+/* GMP's single file mini-gmp, for a smaller (static) binary */
+#ifdef GMPBBS_MINI_GMP
+#include "mini-gmp.h"
+#else
 #include <gmp.h>
+#endif
 
 #ifdef _WIN32
 #include <windows.h>
@@ -53,28 +61,186 @@
 
 #endif /* _WIN32 */
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* from the manual: 5-10 should be sufficient, higher increases probability */
 #ifndef MPZ_PROBAB_PRIME_REPS
 #define MPZ_PROBAB_PRIME_REPS 13
 #endif
 
+/*
+  counters and timers kept by every generator (see rndbbs_get_stats()).
+    ns_square is only kept when bbs->profile is set, since it costs two
+    clock reads per squaring; ns_generate - ns_square is then the time
+    spent extracting and packing bits.
+    bits_discarded counts extractable bits squared for but never returned,
+    i.e. the tail of the last x of each rndbbs_fillbytes() call.
+*/
+typedef struct
+{
+  unsigned long long squarings;
+  unsigned long long bits_extracted;
+  unsigned long long bits_discarded;
+  unsigned long long prime_candidates; /* mpz_nextprime() results */
+  unsigned long long prime_tests; /* mpz_probab_prime_p() calls */
+  unsigned long long entropy_bytes; /* read from HWRANDOM for keys/seeds */
+  unsigned long long whiten_bytes; /* read from URANDOM for xor_urandom */
+
+  unsigned long long ns_keygen; /* rndbbs_gen_blumint(), total */
+  unsigned long long ns_prime; /* prime search, part of ns_keygen */
+  unsigned long long ns_seed; /* rndbbs_gen_x() */
+  unsigned long long ns_entropy; /* HWRANDOM reads, part of the above */
+  unsigned long long ns_generate; /* squaring and bit extraction */
+  unsigned long long ns_square; /* squaring only, part of ns_generate */
+  unsigned long long ns_whiten; /* URANDOM reads for xor_urandom */
+} rndbbs_stats_t;
+
+/*
+  GMPBBS_LOWMEM: the profile for small devices (see Makefile_mipsel).
+    every buffer is fixed and small, and nothing is sized by the request:
+    RNDBBS_RESERVOIR_WORDS 32, RNDBBS_HEALTH_QUEUE 8, and in the gmpbbs
+    program 4 KiB output buffers, 8 KiB per --streams block being
+    generated or written and GMPBBS_RANDINT_CHUNK numbers per
+    rndbbs_randint() call.
+    none of these change the layout of rndbbs_t, so a GMPBBS_LOWMEM
+    libgmpbbs works with programs built against the default headers.
+    target: under 1 MiB peak RSS over the libc/libgmp baseline for any
+    request size, 1024 bit key, with or without -T.
+    output is the same as the default build's, except for -b with more
+    than GMPBBS_RANDINT_CHUNK numbers.
+*/
+#ifdef GMPBBS_LOWMEM
+#ifndef RNDBBS_RESERVOIR_WORDS
+#define RNDBBS_RESERVOIR_WORDS 32
+#endif
+#ifndef RNDBBS_HEALTH_QUEUE
+#define RNDBBS_HEALTH_QUEUE 8
+#endif
+#endif /* GMPBBS_LOWMEM */
+
+/* FIPS 140-2 block size (20000 bits), the test bounds depend on it */
+#define RNDBBS_HEALTH_BLOCK 2500
+
+/* blocks buffered between the generator and the health check thread */
+#ifndef RNDBBS_HEALTH_QUEUE
+#define RNDBBS_HEALTH_QUEUE 256
+#endif
+
+/* consecutive failing blocks before the stream is declared broken */
+#ifndef RNDBBS_HEALTH_MAXFAIL
+#define RNDBBS_HEALTH_MAXFAIL 3
+#endif
+
+typedef struct
+{
+  unsigned long long blocks;
+  unsigned long long ones; /* over all tested blocks */
+  unsigned long long monobit_fail;
+  unsigned long long poker_fail;
+  unsigned long long runs_fail;
+  unsigned long long autocorr_fail;
+  int failed;
+} rndbbs_health_stats_t;
+
+typedef struct rndbbs_health rndbbs_health_t;
+
+/* 64-bit words of output buffered for rndbbs_randbits() and friends */
+#ifndef RNDBBS_RESERVOIR_WORDS
+#define RNDBBS_RESERVOIR_WORDS 512
+#endif
+
+/*
+  bytes per rndbbs_fillbytes() call behind the reservoir, whatever its
+    size, so the values drawn don't depend on RNDBBS_RESERVOIR_WORDS.
+*/
+#ifndef RNDBBS_RESERVOIR_CALL
+#define RNDBBS_RESERVOIR_CALL 4096
+#endif
+
+#if RNDBBS_RESERVOIR_CALL % (8 * RNDBBS_RESERVOIR_WORDS)
+#error "RNDBBS_RESERVOIR_CALL must be a multiple of the reservoir size"
+#endif
+
 typedef struct
 {
   size_t key_bitlen;
   mpz_t blumint;
+  mpz_t p, q; /* factors of blumint, 0 if unknown */
   mpz_t x;
   int improved;
   int xor_urandom;
+  int profile;
+  rndbbs_stats_t stats;
+  rndbbs_health_t *health; /* not owned, see rndbbs_health_new() */
+  int carry_bit; /* next bit of x after rndbbs_fillbytes_partial(), or -1 */
+
+  /*
+    bit reservoir: whole words are taken from res_buf,
+      the unused high bits of the last one wait in res_acc.
+      res_buf (RNDBBS_RESERVOIR_WORDS) is allocated on first use,
+      which keeps its size out of the layout of rndbbs_t.
+  */
+  uint64_t *res_buf;
+  size_t res_pos;
+  size_t res_left; /* of the current RNDBBS_RESERVOIR_CALL */
+  uint64_t res_acc;
+  unsigned int res_bits;
 } rndbbs_t;
 
 int rndbbs_gen_blumint(rndbbs_t *bbs, unsigned int key_bitlen);
 int rndbbs_gen_x(rndbbs_t *bbs);
+int rndbbs_set_key(rndbbs_t *bbs, const mpz_t p, const mpz_t q);
+int rndbbs_set_x(rndbbs_t *bbs, const mpz_t x);
 
 rndbbs_t *rndbbs_new();
 int rndbbs_destroy(rndbbs_t *bbs);
 
+int rndbbs_fillbytes(rndbbs_t *bbs, unsigned char *buf, size_t nbytes);
+int rndbbs_fillbytes_partial(rndbbs_t *bbs, unsigned char *buf,
+			     size_t nbytes);
 char *rndbbs_randbytes(rndbbs_t *bbs, size_t nbytes);
 unsigned int *rndbbs_randint(rndbbs_t *bbs,
 			     unsigned int base, size_t nmemb);
 
+int rndbbs_randbits(rndbbs_t *bbs, uint64_t *out, size_t nmemb,
+		    unsigned int bits);
+int rndbbs_rand_double(rndbbs_t *bbs, double *out, size_t nmemb);
+int rndbbs_rand_float(rndbbs_t *bbs, float *out, size_t nmemb);
+
+int rndbbs_get_stats(rndbbs_t *bbs, rndbbs_stats_t *stats);
+
+uint64_t rndbbs_squarings(rndbbs_t *bbs, size_t nbytes);
+int rndbbs_jump(rndbbs_t *bbs, uint64_t nsquarings);
+int rndbbs_rewind(rndbbs_t *bbs, uint64_t nsquarings);
+
+/* sample.c */
+int rndbbs_randrange(rndbbs_t *bbs, uint64_t *out, size_t nmemb,
+		     uint64_t bound);
+int rndbbs_shuffle(rndbbs_t *bbs, void *base, size_t nmemb, size_t size);
+int rndbbs_permutation(rndbbs_t *bbs, size_t *perm, size_t n);
+int rndbbs_sample(rndbbs_t *bbs, size_t *out, size_t k, size_t n);
+
+/* health.c */
+rndbbs_health_t *rndbbs_health_new(void);
+int rndbbs_health_feed(rndbbs_health_t *health,
+		       const unsigned char *buf, size_t nbytes);
+int rndbbs_health_finish(rndbbs_health_t *health,
+			 rndbbs_health_stats_t *stats);
+
+#ifndef _WIN32
+/* cipher.c */
+int rndbbs_key_save(rndbbs_t *bbs, const char *fn);
+int rndbbs_key_load(rndbbs_t *bbs, const char *fn);
+int rndbbs_encrypt_file(rndbbs_t *bbs, const char *in_fn, const char *out_fn,
+			unsigned int nthreads);
+int rndbbs_decrypt_file(rndbbs_t *bbs, const char *in_fn, const char *out_fn,
+			unsigned int nthreads);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _GMPBBS_H */
@@ -0,0 +1,221 @@
+/* gmpbbs.hpp: C++ interface for the GMPBBS Blum Blum Shub PRNG
+
+  Copyright 2015 Maria Morisot.
+
+  This file is released under the GPL.
+
+  GMPBBS is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License,
+  or (at your option) any later version.
+
+  GMPBBS is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+  for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with GMPBBS; see the file LICENSE.  If not, write to
+  the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+  MA 02111-1307, USA.
+*/
+
+/*
+  gmpbbs::engine owns an rndbbs_t and hands out 64-bit words from a
+  buffer it refills with rndbbs_fillbytes_partial(), so drawing a
+  number costs no allocation, and the words drawn are the same however
+  they are drawn (operator(), generate(), any buffer size).  it satisfies std::uniform_random_bit_generator and
+  can be passed to <random> distributions, std::shuffle, etc.
+
+    gmpbbs::engine eng(2048);
+    std::uniform_int_distribution<int> die(1, 6);
+    int roll = die(eng);
+
+  errors (key generation, a failed health check) throw std::runtime_error.
+*/
+
+
+#ifndef _GMPBBS_HPP
+#define _GMPBBS_HPP 1
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#if __cplusplus >= 202002L
+#include <concepts>
+#include <random>
+#include <span>
+#endif
+
+#include "gmpbbs.h"
+
+namespace gmpbbs
+{
+
+class engine
+{
+public:
+  typedef std::uint64_t result_type;
+
+  /* words generated per refill */
+  static constexpr std::size_t default_buffer_words = 512;
+
+  /* key a fresh generator from the random device */
+  explicit engine(unsigned int key_bitlen = 1024, bool improved = true,
+		  std::size_t buffer_words = default_buffer_words)
+    : bbs_(rndbbs_new()), size_(buffer_words), pos_(buffer_words)
+  {
+    if (bbs_ == NULL)
+      throw std::bad_alloc();
+    bbs_->improved = improved;
+
+    if ( !rndbbs_gen_blumint(bbs_, key_bitlen) || !rndbbs_gen_x(bbs_) )
+      {
+	rndbbs_destroy(bbs_);
+	throw std::runtime_error("gmpbbs: key generation failed");
+      }
+
+    try
+      {
+	alloc_buffer();
+      }
+    catch (...)
+      {
+	rndbbs_destroy(bbs_);
+	throw;
+      }
+  }
+
+  /*
+    take ownership of an already keyed generator (e.g. from -p/-q/-x).
+      if this throws, the caller still owns bbs.
+  */
+  explicit engine(rndbbs_t *bbs,
+		  std::size_t buffer_words = default_buffer_words)
+    : bbs_(bbs), size_(buffer_words), pos_(buffer_words)
+  {
+    alloc_buffer();
+  }
+
+  ~engine()
+  {
+    if (bbs_ != NULL)
+      rndbbs_destroy(bbs_);
+  }
+
+  engine(const engine &) = delete;
+  engine &operator=(const engine &) = delete;
+
+  engine(engine &&other) noexcept
+    : bbs_(other.bbs_), buf_(std::move(other.buf_)),
+      size_(other.size_), pos_(other.pos_)
+  {
+    other.bbs_ = NULL;
+    other.size_ = other.pos_ = 0;
+  }
+
+  engine &operator=(engine &&other) noexcept
+  {
+    if (this != &other)
+      {
+	if (bbs_ != NULL)
+	  rndbbs_destroy(bbs_);
+	bbs_ = other.bbs_;
+	buf_ = std::move(other.buf_);
+	size_ = other.size_;
+	pos_ = other.pos_;
+	other.bbs_ = NULL;
+	other.size_ = other.pos_ = 0;
+      }
+    return *this;
+  }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return ~result_type(0); }
+
+  result_type operator()()
+  {
+    if (pos_ == size_)
+      refill();
+    return buf_[pos_++];
+  }
+
+  /*
+    fill out[0..n) with words.
+      buffered words go first, whole buffers' worth are generated
+      straight into out, the remainder comes from a refill.
+  */
+  void generate(result_type *out, std::size_t n)
+  {
+    std::size_t k = size_ - pos_;
+
+    if (k > n)
+      k = n;
+    for (std::size_t i = 0; i < k; i++)
+      out[i] = buf_[pos_++];
+    out += k;
+    n -= k;
+
+    if (n >= size_)
+      {
+	std::size_t direct = n - n % size_;
+
+	fill(out, direct);
+	out += direct;
+	n -= direct;
+      }
+
+    for (std::size_t i = 0; i < n; i++)
+      out[i] = (*this)();
+  }
+
+#if __cplusplus >= 202002L
+  void generate(std::span<result_type> out)
+  {
+    generate(out.data(), out.size());
+  }
+#endif
+
+  /* the underlying generator, still owned by the engine */
+  rndbbs_t *get() noexcept { return bbs_; }
+  const rndbbs_t *get() const noexcept { return bbs_; }
+
+private:
+  rndbbs_t *bbs_;
+  std::unique_ptr<result_type[]> buf_;
+  std::size_t size_;
+  std::size_t pos_;
+
+  void alloc_buffer()
+  {
+    if (size_ == 0)
+      size_ = pos_ = 1;
+    buf_.reset(new result_type[size_]);
+  }
+
+  void fill(result_type *out, std::size_t n)
+  {
+    if (!rndbbs_fillbytes_partial(bbs_,
+				  reinterpret_cast<unsigned char *>(out),
+				  n * sizeof(result_type)))
+      throw std::runtime_error("gmpbbs: rndbbs_fillbytes_partial failed");
+  }
+
+  void refill()
+  {
+    fill(buf_.get(), size_);
+    pos_ = 0;
+  }
+};
+
+#if __cplusplus >= 202002L
+static_assert(std::uniform_random_bit_generator<engine>);
+#endif
+
+} /* namespace gmpbbs */
+
+#endif /* _GMPBBS_HPP */
@@ -0,0 +1,639 @@
+/* gmpbbsd.c: local randomness daemon for the GMPBBS Blum Blum Shub PRNG
+
+  Copyright 2015 Maria Morisot.
+
+  This file is released under the GPL.
+
+  GMPBBS is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License,
+  or (at your option) any later version.
+
+  GMPBBS is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+  for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with GMPBBS; see the file LICENSE.  If not, write to
+  the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+  MA 02111-1307, USA.
+*/
+
+/*
+  gmpbbsd keys one or more generators once at startup and keeps a
+  prefilled pool of output for each of them.  clients connect to a
+  UNIX domain socket and send rndbbsd_req_t requests (see gmpbbsd.h);
+  the reply is streamed straight out of the pool.
+
+  everything runs in one epoll loop: whenever no client is ready,
+  the loop tops up the emptiest pool one chunk at a time, so a busy
+  daemon serves from warm buffers and an idle one sleeps once all
+  pools are full.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#include "gmpbbs.h"
+#include "gmpbbsd.h"
+
+/* bytes generated per pool top-up, small enough to keep the loop responsive */
+#ifndef GMPBBSD_FILL_CHUNK
+#define GMPBBSD_FILL_CHUNK 4096
+#endif
+
+/* most bytes sent to one client per wakeup, so big requests can't starve */
+#ifndef GMPBBSD_SEND_CHUNK
+#define GMPBBSD_SEND_CHUNK 65536
+#endif
+
+#ifndef GMPBBSD_MAXEVENTS
+#define GMPBBSD_MAXEVENTS 64
+#endif
+
+typedef struct
+{
+  rndbbs_t *bbs;
+  unsigned char *buf;
+  size_t size;
+  size_t head;
+  size_t len;
+} pool_t;
+
+typedef struct
+{
+  int fd;
+  unsigned char req[sizeof(rndbbsd_req_t)];
+  size_t reqlen;
+  uint64_t pending;
+  unsigned int gen;
+} client_t;
+
+static pool_t *pools = NULL;
+static unsigned int npools = 0;
+static int epfd = -1;
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int sig)
+{
+  stop = 1;
+}
+
+void usage (const char *me)
+{
+  fprintf(stderr,
+	  "usage: %s [-hsXTD] [-S socket] [-n generators] [-k key_bitlen]\n"
+	  "      \t[-P pool_bytes]\n\n"
+	  "   -h, --help       :\tthis help message\n"
+	  "   -S, --socket     :\tUNIX socket to listen on (default %s)\n"
+	  "   -n, --generators :\tnumber of independently keyed generators\n"
+	  "   -k, --keylen     :\trequested key length (k>=%d) (default 1024)\n"
+	  "   -P, --pool       :\tprefilled bytes kept per generator\n"
+	  "   -s, --slow       :\tdon't use the improved (fast) algorithm\n"
+	  "   -X, --xor        :\tXOR BBS output with output from /dev/urandom\n"
+	  "   -T, --health     :\tcontinuously test every generator's output,\n"
+	  "                    \tand exit if one stops looking random\n"
+	  "   -D, --daemon     :\tdetach and run in the background\n"
+	  , me, GMPBBSD_SOCKET, GMPBBS_MINKEYLEN);
+}
+
+/* fill up to GMPBBSD_FILL_CHUNK contiguous bytes at the tail of a pool */
+static int pool_fill(pool_t *pool)
+#define FUNC_NAME "pool_fill"
+{
+  size_t tail = (pool->head + pool->len) % pool->size;
+  size_t n = pool->size - pool->len;
+
+  if (n > pool->size - tail)
+    n = pool->size - tail;
+  if (n > GMPBBSD_FILL_CHUNK)
+    n = GMPBBSD_FILL_CHUNK;
+  if (n == 0)
+    return(1);
+
+  if (!rndbbs_fillbytes(pool->bbs, pool->buf + tail, n))
+    {
+      /* a generator we can't trust anymore takes the daemon down with it */
+      fprintf(stderr, FUNC_NAME ": rndbbs_fillbytes failed, exiting\n");
+      stop = 1;
+      return(0);
+    }
+  pool->len += n;
+
+  return(1);
+}
+#undef FUNC_NAME
+
+/* the pool with the least buffered output, or NULL when all are full */
+static pool_t *pool_emptiest(void)
+{
+  pool_t *best = NULL;
+  unsigned int i;
+
+  for (i=0;i<npools;i++)
+    {
+      if (pools[i].len == pools[i].size)
+	continue;
+      if ( (best == NULL) || (pools[i].len < best->len) )
+	best = &pools[i];
+    }
+
+  return(best);
+}
+
+static unsigned int pool_fullest(void)
+{
+  unsigned int i, best = 0;
+
+  for (i=1;i<npools;i++)
+    if (pools[i].len > pools[best].len)
+      best = i;
+
+  return(best);
+}
+
+static void client_close(client_t *cl)
+{
+  epoll_ctl(epfd, EPOLL_CTL_DEL, cl->fd, NULL);
+  close(cl->fd);
+  free(cl);
+}
+
+/* wait for a request while idle, for room in the socket while streaming */
+static int client_watch(client_t *cl)
+#define FUNC_NAME "client_watch"
+{
+  struct epoll_event ev;
+
+  ev.events = (cl->pending ? EPOLLOUT : EPOLLIN);
+  ev.data.ptr = cl;
+  if (epoll_ctl(epfd, EPOLL_CTL_MOD, cl->fd, &ev) == -1)
+    {
+      perror(FUNC_NAME ": epoll_ctl");
+      return(0);
+    }
+
+  return(1);
+}
+#undef FUNC_NAME
+
+/* stream up to GMPBBSD_SEND_CHUNK bytes of the current request */
+static int client_send(client_t *cl)
+#define FUNC_NAME "client_send"
+{
+  pool_t *pool = &pools[cl->gen];
+  size_t budget = GMPBBSD_SEND_CHUNK;
+
+  while ( (cl->pending > 0) && (budget > 0) )
+    {
+      size_t n;
+      ssize_t sent;
+
+      /* nothing warm left: generate in line rather than stall the client */
+      if (pool->len == 0)
+	if (!pool_fill(pool))
+	  return(0);
+
+      n = pool->len;
+      if (n > pool->size - pool->head)
+	n = pool->size - pool->head;
+      if (n > cl->pending)
+	n = cl->pending;
+      if (n > budget)
+	n = budget;
+
+      sent = send(cl->fd, pool->buf + pool->head, n,
+		  MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (sent == -1)
+	{
+	  if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) )
+	    break;
+	  if (errno == EINTR)
+	    continue;
+	  return(0);
+	}
+
+      /* output handed to a client is never handed out again */
+      pool->head = (pool->head + sent) % pool->size;
+      pool->len -= sent;
+      cl->pending -= sent;
+      budget -= sent;
+    }
+
+  if (cl->pending == 0)
+    return(client_watch(cl));
+
+  return(1);
+}
+#undef FUNC_NAME
+
+static int client_recv(client_t *cl)
+#define FUNC_NAME "client_recv"
+{
+  rndbbsd_req_t req;
+  ssize_t n;
+
+  n = recv(cl->fd, cl->req + cl->reqlen, sizeof(cl->req) - cl->reqlen,
+	   MSG_DONTWAIT);
+  if (n == 0)
+    return(0);
+  if (n == -1)
+    return( (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) );
+
+  cl->reqlen += n;
+  if (cl->reqlen < sizeof(cl->req))
+    return(1);
+
+  memcpy(&req, cl->req, sizeof(req));
+  cl->reqlen = 0;
+
+  if (req.magic != GMPBBSD_MAGIC)
+    return(0);
+
+  if (req.generator == GMPBBSD_ANY)
+    cl->gen = pool_fullest();
+  else if (req.generator < npools)
+    cl->gen = req.generator;
+  else
+    return(0);
+
+  if ( (cl->pending = req.nbytes) == 0 )
+    return(1);
+
+  if (!client_watch(cl))
+    return(0);
+
+  return(client_send(cl));
+}
+#undef FUNC_NAME
+
+static int accept_clients(int lfd)
+#define FUNC_NAME "accept_clients"
+{
+  for (;;)
+    {
+      struct epoll_event ev;
+      client_t *cl;
+      int fd;
+
+      if ( (fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) == -1 )
+	{
+	  if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) )
+	    return(1);
+	  if (errno == EINTR)
+	    continue;
+	  perror(FUNC_NAME ": accept4");
+	  return(0);
+	}
+
+      if ( (cl = (client_t *) calloc(1, sizeof(client_t))) == NULL )
+	{
+	  perror(FUNC_NAME ": calloc");
+	  close(fd);
+	  continue;
+	}
+      cl->fd = fd;
+
+      ev.events = EPOLLIN;
+      ev.data.ptr = cl;
+      if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+	{
+	  perror(FUNC_NAME ": epoll_ctl");
+	  close(fd);
+	  free(cl);
+	}
+    }
+}
+#undef FUNC_NAME
+
+static int listen_socket(const char *path)
+#define FUNC_NAME "listen_socket"
+{
+  struct sockaddr_un sun;
+  struct stat st;
+  int fd;
+
+  if (strlen(path) >= sizeof(sun.sun_path))
+    {
+      fprintf(stderr, FUNC_NAME ": socket path too long\n");
+      return(-1);
+    }
+
+  /* the default lives in a directory of its own, made by whoever runs us */
+  if ( (strcmp(path, GMPBBSD_SOCKET) == 0) &&
+       (mkdir(GMPBBSD_SOCKET_DIR, 0755) == -1) && (errno != EEXIST) )
+    {
+      perror(FUNC_NAME ": mkdir " GMPBBSD_SOCKET_DIR);
+      return(-1);
+    }
+
+  if ( (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0))
+       == -1 )
+    {
+      perror(FUNC_NAME ": socket");
+      return(-1);
+    }
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  strcpy(sun.sun_path, path);
+
+  /*
+    a stale socket from a previous run would make bind() fail, but only
+    remove it if nobody answers: never steal a live daemon's socket
+  */
+  if (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) == -1)
+    {
+      int probe, err = errno;
+
+      if (err != EADDRINUSE)
+	{
+	  perror(FUNC_NAME ": bind");
+	  close(fd);
+	  return(-1);
+	}
+
+      if ( (probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1 )
+	{
+	  perror(FUNC_NAME ": socket");
+	  close(fd);
+	  return(-1);
+	}
+      if (connect(probe, (struct sockaddr *) &sun, sizeof(sun)) == 0)
+	{
+	  fprintf(stderr, FUNC_NAME ": %s: another gmpbbsd is listening\n",
+		  path);
+	  close(probe);
+	  close(fd);
+	  return(-1);
+	}
+      err = errno;
+      close(probe);
+
+      if ( (err != ECONNREFUSED) && (err != ENOENT) )
+	{
+	  errno = err;
+	  perror(FUNC_NAME ": connect");
+	  close(fd);
+	  return(-1);
+	}
+
+      /* connect() to a regular file is refused too, so look first */
+      if ( (lstat(path, &st) == 0) && !S_ISSOCK(st.st_mode) )
+	{
+	  fprintf(stderr, FUNC_NAME ": %s: exists and is not a socket\n",
+		  path);
+	  close(fd);
+	  return(-1);
+	}
+
+      unlink(path);
+      if (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) == -1)
+	{
+	  perror(FUNC_NAME ": bind");
+	  close(fd);
+	  return(-1);
+	}
+    }
+
+  if (listen(fd, SOMAXCONN) == -1)
+    {
+      perror(FUNC_NAME ": listen");
+      close(fd);
+      unlink(path);
+      return(-1);
+    }
+
+  return(fd);
+}
+#undef FUNC_NAME
+
+int main(int argc, char **argv)
+{
+  const char *sock_fn = GMPBBSD_SOCKET;
+  unsigned int i;
+  int ngen = 1;
+  int keylen = 1024;
+  long pool_bytes = 1048576;
+  int improved = 1, xor_urandom = 0, health = 0, detach = 0;
+  int lfd, ret = 0;
+  struct epoll_event ev;
+  struct sigaction sa;
+
+  int opt, option_index=0;
+
+  static struct option long_options[] =
+    {
+      { "socket", 1, NULL, 'S' },
+      { "generators", 1, NULL, 'n' },
+      { "keylen", 1, NULL, 'k' },
+      { "pool", 1, NULL, 'P' },
+      { "slow", 0, NULL, 's' },
+      { "xor", 0, NULL, 'X' },
+      { "health", 0, NULL, 'T' },
+      { "daemon", 0, NULL, 'D' },
+      { "help", 0, NULL, 'h' },
+      { NULL, 0, NULL, 0 }
+    };
+
+  while ((opt =
+	  getopt_long(argc, argv, "sXTDhS:n:k:P:",
+		      long_options, &option_index)) != -1)
+    {
+      switch(opt)
+	{
+	case 'h':
+	  usage(argv[0]);
+	  return(0);
+	case 'S':
+	  sock_fn = optarg;
+	  break;
+	case 'n':
+	  ngen = atoi(optarg);
+	  if (ngen < 1)
+	    {
+	      usage(argv[0]);
+	      return(1);
+	    }
+	  break;
+	case 'k':
+	  keylen = atoi(optarg);
+	  if (keylen < GMPBBS_MINKEYLEN)
+	    {
+	      usage(argv[0]);
+	      return(1);
+	    }
+	  break;
+	case 'P':
+	  pool_bytes = atol(optarg);
+	  if (pool_bytes < GMPBBSD_FILL_CHUNK)
+	    {
+	      usage(argv[0]);
+	      return(1);
+	    }
+	  break;
+	case 's':
+	  improved = 0;
+	  break;
+	case 'X':
+	  xor_urandom = 1;
+	  break;
+	case 'T':
+	  health = 1;
+	  break;
+	case 'D':
+	  detach = 1;
+	  break;
+	default:
+	  usage(argv[0]);
+	  return(1);
+	}
+    }
+
+  /* key every generator before we start accepting, this is the slow part */
+  npools = ngen;
+  if ( (pools = (pool_t *) calloc(npools, sizeof(pool_t))) == NULL )
+    {
+      perror("calloc");
+      return(1);
+    }
+  for (i=0;i<npools;i++)
+    {
+      if ( (pools[i].bbs = rndbbs_new()) == NULL )
+	return(1);
+      pools[i].bbs->improved = improved;
+      pools[i].bbs->xor_urandom = xor_urandom;
+
+      if ( !rndbbs_gen_blumint(pools[i].bbs, keylen) ||
+	   !rndbbs_gen_x(pools[i].bbs) )
+	{
+	  fprintf(stderr, "failed to key generator %u\n", i);
+	  return(1);
+	}
+
+      pools[i].size = pool_bytes;
+      if ( (pools[i].buf = (unsigned char *) malloc(pool_bytes)) == NULL )
+	{
+	  perror("malloc");
+	  return(1);
+	}
+    }
+
+  if ( (lfd = listen_socket(sock_fn)) == -1 )
+    return(1);
+
+  if (detach && (daemon(0, 0) == -1))
+    {
+      perror("daemon");
+      unlink(sock_fn);
+      return(1);
+    }
+
+  /* the health threads don't survive daemon()'s fork, start them after.
+     a failed health check makes pool_fill() fail, and us exit */
+  for (i=0;i<npools;i++)
+    if ( health &&
+	 ((pools[i].bbs->health = rndbbs_health_new()) == NULL) )
+      {
+	unlink(sock_fn);
+	return(1);
+      }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  if ( (epfd = epoll_create1(EPOLL_CLOEXEC)) == -1 )
+    {
+      perror("epoll_create1");
+      unlink(sock_fn);
+      return(1);
+    }
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev) == -1)
+    {
+      perror("epoll_ctl");
+      unlink(sock_fn);
+      return(1);
+    }
+
+  while (!stop)
+    {
+      struct epoll_event events[GMPBBSD_MAXEVENTS];
+      pool_t *idle = pool_emptiest();
+      int n, e;
+
+      /* only block once every pool is full */
+      n = epoll_wait(epfd, events, GMPBBSD_MAXEVENTS, (idle ? 0 : -1));
+      if (n == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  perror("epoll_wait");
+	  ret = 1;
+	  break;
+	}
+
+      if (n == 0)
+	{
+	  if (!pool_fill(idle))
+	    {
+	      ret = 1;
+	      break;
+	    }
+	  continue;
+	}
+
+      for (e=0;e<n;e++)
+	{
+	  client_t *cl = (client_t *) events[e].data.ptr;
+
+	  if (cl == NULL)
+	    {
+	      if (!accept_clients(lfd))
+		stop = 1;
+	      continue;
+	    }
+
+	  if (events[e].events & (EPOLLERR | EPOLLHUP))
+	    {
+	      client_close(cl);
+	      continue;
+	    }
+
+	  if ( (cl->pending ? client_send(cl) : client_recv(cl)) == 0 )
+	    client_close(cl);
+	}
+    }
+
+  close(lfd);
+  unlink(sock_fn);
+
+  for (i=0;i<npools;i++)
+    {
+      if ( (pools[i].bbs->health != NULL) &&
+	   !rndbbs_health_finish(pools[i].bbs->health, NULL) )
+	ret = 1;
+      rndbbs_destroy(pools[i].bbs);
+      free(pools[i].buf);
+    }
+  free(pools);
+
+  return(ret);
+}
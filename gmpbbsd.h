@@ -0,0 +1,79 @@
+/* gmpbbsd.h: protocol and client library for the GMPBBS randomness daemon
+
+  Copyright 2015 Maria Morisot.
+
+  This file is released under the GPL.
+
+  GMPBBS is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License,
+  or (at your option) any later version.
+
+  GMPBBS is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+  for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with GMPBBS; see the file LICENSE.  If not, write to
+  the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+  MA 02111-1307, USA.
+*/
+
+
+#ifndef _GMPBBSD_H
+#define _GMPBBSD_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  default socket path, override with gmpbbsd -S / rndbbsd_connect().
+    not in /tmp: whoever binds a world-writable path first would be
+    handing out the "random" bytes.  gmpbbsd creates the directory.
+*/
+#ifndef GMPBBSD_SOCKET_DIR
+#define GMPBBSD_SOCKET_DIR "/run/gmpbbsd"
+#endif
+#ifndef GMPBBSD_SOCKET
+#define GMPBBSD_SOCKET GMPBBSD_SOCKET_DIR "/gmpbbsd.sock"
+#endif
+
+/* "BBSD" */
+#define GMPBBSD_MAGIC 0x42425344
+
+/* let the daemon pick a generator for us */
+#define GMPBBSD_ANY 0xffffffff
+
+/*
+  a request is a fixed size header in host byte order
+    (the socket is local, so there is nobody to disagree with).
+    the daemon answers with exactly nbytes of raw output,
+    streamed as fast as the client reads it.
+    requests may be pipelined on one connection;
+    a malformed request closes the connection.
+*/
+typedef struct
+{
+  uint32_t magic;
+  uint32_t generator;
+  uint64_t nbytes;
+} rndbbsd_req_t;
+
+typedef struct
+{
+  int fd;
+  uint32_t generator;
+} rndbbsd_t;
+
+/*
+  connects only to a daemon run by root or by the calling user
+    (SO_PEERCRED), anyone else could feed us chosen bytes.
+*/
+rndbbsd_t *rndbbsd_connect(const char *path);
+int rndbbsd_close(rndbbsd_t *bbsd);
+
+int rndbbsd_fillbytes(rndbbsd_t *bbsd, unsigned char *buf, size_t nbytes);
+char *rndbbsd_randbytes(rndbbsd_t *bbsd, size_t nbytes);
+
+#endif /* _GMPBBSD_H */
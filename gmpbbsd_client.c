@@ -0,0 +1,178 @@
+/* gmpbbsd_client.c: client library for the GMPBBS randomness daemon
+
+  Copyright 2015 Maria Morisot.
+
+  This file is released under the GPL.
+
+  GMPBBS is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License,
+  or (at your option) any later version.
+
+  GMPBBS is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+  for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with GMPBBS; see the file LICENSE.  If not, write to
+  the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+  MA 02111-1307, USA.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "gmpbbsd.h"
+
+rndbbsd_t *rndbbsd_connect(const char *path)
+#define FUNC_NAME "rndbbsd_connect"
+{
+  rndbbsd_t *bbsd;
+  struct sockaddr_un sun;
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+
+  if (path == NULL)
+    path = GMPBBSD_SOCKET;
+
+  if (strlen(path) >= sizeof(sun.sun_path))
+    {
+      fprintf(stderr, FUNC_NAME ": socket path too long\n");
+      return(NULL);
+    }
+
+  if ( (bbsd = (rndbbsd_t *) malloc(sizeof(rndbbsd_t))) == NULL )
+    {
+      perror(FUNC_NAME ": malloc");
+      return(NULL);
+    }
+  bbsd->generator = GMPBBSD_ANY;
+
+  if ( (bbsd->fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 )
+    {
+      perror(FUNC_NAME ": socket");
+      free(bbsd);
+      return(NULL);
+    }
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  strcpy(sun.sun_path, path);
+
+  if (connect(bbsd->fd, (struct sockaddr *) &sun, sizeof(sun)) == -1)
+    {
+      perror(FUNC_NAME ": connect");
+      close(bbsd->fd);
+      free(bbsd);
+      return(NULL);
+    }
+
+  if (getsockopt(bbsd->fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+    {
+      perror(FUNC_NAME ": getsockopt");
+      close(bbsd->fd);
+      free(bbsd);
+      return(NULL);
+    }
+  if ( (cred.uid != 0) && (cred.uid != getuid()) )
+    {
+      fprintf(stderr, FUNC_NAME ": %s: served by uid %u, not trusted\n",
+	      path, (unsigned int) cred.uid);
+      close(bbsd->fd);
+      free(bbsd);
+      return(NULL);
+    }
+
+  return(bbsd);
+}
+#undef FUNC_NAME
+
+int rndbbsd_close(rndbbsd_t *bbsd)
+{
+  close(bbsd->fd);
+  free(bbsd);
+
+  return(1);
+}
+
+int rndbbsd_fillbytes(rndbbsd_t *bbsd, unsigned char *buf, size_t nbytes)
+#define FUNC_NAME "rndbbsd_fillbytes"
+{
+  rndbbsd_req_t req;
+  size_t done = 0;
+
+  req.magic = GMPBBSD_MAGIC;
+  req.generator = bbsd->generator;
+  req.nbytes = nbytes;
+
+  /* a library must not kill its caller with SIGPIPE if gmpbbsd hangs
+     up, so send() with MSG_NOSIGNAL and leave errno at EPIPE */
+  while (done < sizeof(req))
+    {
+      ssize_t n = send(bbsd->fd, ((char *) &req) + done, sizeof(req) - done,
+		       MSG_NOSIGNAL);
+
+      if (n == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  n = errno;
+	  perror(FUNC_NAME ": send");
+	  errno = n;
+	  return(0);
+	}
+      done += n;
+    }
+
+  done = 0;
+  while (done < nbytes)
+    {
+      ssize_t n = read(bbsd->fd, buf + done, nbytes - done);
+
+      if (n == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  perror(FUNC_NAME ": read");
+	  return(0);
+	}
+      if (n == 0)
+	{
+	  fprintf(stderr, FUNC_NAME ": connection closed by gmpbbsd\n");
+	  return(0);
+	}
+      done += n;
+    }
+
+  return(1);
+}
+#undef FUNC_NAME
+
+char *rndbbsd_randbytes(rndbbsd_t *bbsd, size_t nbytes)
+#define FUNC_NAME "rndbbsd_randbytes"
+{
+  char *retbuf;
+
+  if ( (retbuf = (char *) malloc(nbytes)) == NULL)
+    {
+      perror(FUNC_NAME ": malloc");
+      return(NULL);
+    }
+
+  if (!rndbbsd_fillbytes(bbsd, (unsigned char *) retbuf, nbytes))
+    {
+      free(retbuf);
+      return(NULL);
+    }
+
+  return(retbuf);
+}
+#undef FUNC_NAME
@@ -0,0 +1,413 @@
+/* health.c: streaming statistical self-test for the GMPBBS Blum Blum Shub PRNG
+
+  Copyright 2015 Maria Morisot.
+
+  This file is released under the GPL.
+
+  GMPBBS is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License,
+  or (at your option) any later version.
+
+  GMPBBS is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+  for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with GMPBBS; see the file LICENSE.  If not, write to
+  the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+  MA 02111-1307, USA.
+*/
+
+/*
+  the generated stream is cut into FIPS 140-2 sized blocks of 20000 bits
+  and every block gets the monobit, poker and runs (incl. long run) tests
+  with the FIPS 140-2 bounds, plus an autocorrelation test at a few shifts.
+
+  each of those fails a good generator about once in 10^4 blocks,
+  so a single bad block is only counted; we declare the stream broken
+  once RNDBBS_HEALTH_MAXFAIL blocks in a row fail.
+
+  the producer copies output into a ring of blocks and a worker thread
+  tests them, so generation only waits when the ring is full.
+*/
+
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "gmpbbs.h"
+
+#define BLOCK_BITS (8 * RNDBBS_HEALTH_BLOCK)
+#define BLOCK_WORDS ((RNDBBS_HEALTH_BLOCK + 7) / 8)
+
+/* shifts for the autocorrelation test (1 <= d < 64) */
+static const unsigned int autocorr_shifts[] = { 1, 2, 8, 16, 32 };
+
+/* |z| bound for the autocorrelation test, about the FIPS tests' 10^-4 */
+#define AUTOCORR_ZMAX 3.9
+
+struct rndbbs_health
+{
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  unsigned char (*ring)[RNDBBS_HEALTH_BLOCK];
+  size_t head; /* next block to test */
+  size_t count; /* blocks queued */
+  size_t fill; /* bytes in the block at head+count */
+  int done;
+
+  unsigned int consecutive;
+  rndbbs_health_stats_t stats;
+};
+
+/* block -> big endian words, so bit 63 of w[0] is the first bit out */
+static void load_words(const unsigned char *blk, uint64_t *w)
+{
+  size_t i, k;
+
+  for (k=0;k<BLOCK_WORDS;k++)
+    {
+      uint64_t v = 0;
+
+      for (i=0;i<8;i++)
+	{
+	  size_t b = 8*k + i;
+
+	  v = (v << 8) | ( (b < RNDBBS_HEALTH_BLOCK) ? blk[b] : 0 );
+	}
+      w[k] = v;
+    }
+}
+
+static unsigned long monobit(const uint64_t *w)
+{
+  unsigned long ones = 0;
+  size_t k;
+
+  /* the padding in the last word is zero */
+  for (k=0;k<BLOCK_WORDS;k++)
+    ones += __builtin_popcountll(w[k]);
+
+  return(ones);
+}
+
+static double poker(const unsigned char *blk)
+{
+  unsigned long f[16] = { 0 };
+  double sum = 0;
+  size_t i;
+
+  for (i=0;i<RNDBBS_HEALTH_BLOCK;i++)
+    {
+      f[blk[i] >> 4]++;
+      f[blk[i] & 0x0f]++;
+    }
+  for (i=0;i<16;i++)
+    sum += (double) f[i] * f[i];
+
+  return( 16.0 / (BLOCK_BITS / 4) * sum - (BLOCK_BITS / 4) );
+}
+
+/* bits d..d+63 of the stream starting at word k, i.e. bit i -> bit i+d */
+static inline uint64_t shifted(const uint64_t *v, size_t k, unsigned int d)
+{
+  uint64_t next = (k+1 < BLOCK_WORDS) ? v[k+1] : 0;
+
+  return( d ? ( (v[k] << d) | (next >> (64 - d)) ) : v[k] );
+}
+
+/*
+  runs test, word-parallel:
+    a run starts where a bit differs from the one before it, and is at
+    least L long if the L bits from there are all set in v.
+    ANDing in one more shifted copy of v per L, the number of runs of
+    length >= L is popcount(start & a), and a run of 26 exists if a
+    survives 26 rounds.
+    v is the block for runs of ones, its complement for runs of zeros.
+*/
+static unsigned int runs_of(const uint64_t *v, unsigned long nruns[6])
+{
+  unsigned long atleast[7] = { 0 };
+  unsigned int longrun = 0;
+  size_t k;
+
+  for (k=0;k<BLOCK_WORDS;k++)
+    {
+      uint64_t prev = (v[k] >> 1) | ( k ? (v[k-1] << 63) : 0 );
+      uint64_t start = v[k] & ~prev;
+      uint64_t a = v[k];
+      unsigned int len;
+
+      for (len=1;len<=26;len++)
+	{
+	  if (len > 1)
+	    a &= shifted(v, k, len-1);
+	  if (len <= 7)
+	    atleast[len-1] += __builtin_popcountll(start & a);
+	  else if (a == 0)
+	    break;
+	}
+      if (a != 0)
+	longrun = 1;
+    }
+
+  for (k=0;k<5;k++)
+    nruns[k] = atleast[k] - atleast[k+1];
+  nruns[5] = atleast[5];
+
+  return(longrun);
+}
+
+/* number of i < BLOCK_BITS-d with bit i != bit i+d */
+static unsigned long autocorr(const uint64_t *w, unsigned int d)
+{
+  unsigned long n = 0;
+  unsigned int limit = BLOCK_BITS - d;
+  size_t k;
+
+  for (k=0;64*k<limit;k++)
+    {
+      uint64_t x = w[k] ^ shifted(w, k, d);
+
+      if (limit - 64*k < 64)
+	x &= ~0ULL << (64 - (limit - 64*k));
+
+      n += __builtin_popcountll(x);
+    }
+
+  return(n);
+}
+
+/* append one failure description to why[] */
+#define WHY(...) \
+  snprintf(why + strlen(why), sizeof(why) - strlen(why), __VA_ARGS__)
+
+/*
+  run every test on one block.
+    isolated failures are only counted, we complain on stderr
+    when the stream is declared broken.
+*/
+static int test_block(rndbbs_health_t *health, const unsigned char *blk)
+#define FUNC_NAME "rndbbs_health"
+{
+  static const unsigned long run_lo[6] = { 2315, 1114, 527, 240, 103, 103 };
+  static const unsigned long run_hi[6] = { 2685, 1386, 723, 384, 209, 209 };
+  rndbbs_health_stats_t *st = &health->stats;
+  uint64_t w[BLOCK_WORDS], z[BLOCK_WORDS];
+  unsigned long ones, runs0[6], runs1[6];
+  unsigned int longrun, i;
+  char why[256] = "";
+  double x;
+
+  load_words(blk, w);
+  st->blocks++;
+
+  ones = monobit(w);
+  st->ones += ones;
+  if ( (ones <= 9725) || (ones >= 10275) )
+    {
+      WHY(" monobit %lu;", ones);
+      st->monobit_fail++;
+    }
+
+  x = poker(blk);
+  if ( (x <= 2.16) || (x >= 46.17) )
+    {
+      WHY(" poker %.2f;", x);
+      st->poker_fail++;
+    }
+
+  for (i=0;i<BLOCK_WORDS;i++)
+    z[i] = ~w[i];
+  /* the padding must not count as a run of zeros */
+  if (BLOCK_BITS % 64)
+    z[BLOCK_WORDS-1] &= ~0ULL << (64 - BLOCK_BITS % 64);
+  longrun = runs_of(w, runs1) | runs_of(z, runs0);
+  for (i=0;i<6;i++)
+    if ( (runs0[i] < run_lo[i]) || (runs0[i] > run_hi[i]) ||
+	 (runs1[i] < run_lo[i]) || (runs1[i] > run_hi[i]) )
+      break;
+  if (i < 6)
+    WHY(" runs of length %u%s: %lu zero, %lu one;",
+	i+1, (i == 5) ? "+" : "", runs0[i], runs1[i]);
+  else if (longrun)
+    WHY(" run of 26 or more;");
+  if ( (i < 6) || longrun )
+    st->runs_fail++;
+
+  for (i=0;i<sizeof(autocorr_shifts)/sizeof(autocorr_shifts[0]);i++)
+    {
+      unsigned int d = autocorr_shifts[i];
+      double n = BLOCK_BITS - d;
+      double z = 2.0 * (autocorr(w, d) - n / 2) / sqrt(n);
+
+      if (fabs(z) > AUTOCORR_ZMAX)
+	{
+	  WHY(" autocorrelation d=%u z=%.2f;", d, z);
+	  st->autocorr_fail++;
+	  break;
+	}
+    }
+
+  if (why[0] == '\0')
+    {
+      health->consecutive = 0;
+      return(1);
+    }
+
+  if (++health->consecutive == RNDBBS_HEALTH_MAXFAIL)
+    fprintf(stderr, FUNC_NAME ": FAILURE: %u consecutive blocks failed, "
+	    "output is not random (block %llu:%s)\n",
+	    health->consecutive, st->blocks, why);
+
+  return(health->consecutive < RNDBBS_HEALTH_MAXFAIL);
+}
+#undef FUNC_NAME
+#undef WHY
+
+static void *worker(void *arg)
+{
+  rndbbs_health_t *health = (rndbbs_health_t *) arg;
+
+  pthread_mutex_lock(&health->lock);
+  for (;;)
+    {
+      const unsigned char *blk;
+      int ok;
+
+      while ( (health->count == 0) && !health->done )
+	pthread_cond_wait(&health->cond, &health->lock);
+      if (health->count == 0)
+	break;
+
+      /* the producer never touches a queued block, test it unlocked */
+      blk = health->ring[health->head];
+      pthread_mutex_unlock(&health->lock);
+      ok = test_block(health, blk);
+      pthread_mutex_lock(&health->lock);
+
+      health->head = (health->head + 1) % RNDBBS_HEALTH_QUEUE;
+      health->count--;
+      if (!ok)
+	health->stats.failed = 1;
+      pthread_cond_broadcast(&health->cond);
+    }
+  pthread_mutex_unlock(&health->lock);
+
+  return(NULL);
+}
+
+rndbbs_health_t *rndbbs_health_new(void)
+#define FUNC_NAME "rndbbs_health_new"
+{
+  rndbbs_health_t *health;
+  int err;
+
+  if ( (health = (rndbbs_health_t *) calloc(1, sizeof(rndbbs_health_t)))
+       == NULL )
+    {
+      perror(FUNC_NAME ": calloc");
+      return(NULL);
+    }
+
+  if ( (health->ring = (unsigned char (*)[RNDBBS_HEALTH_BLOCK])
+	malloc(RNDBBS_HEALTH_QUEUE * RNDBBS_HEALTH_BLOCK)) == NULL )
+    {
+      perror(FUNC_NAME ": malloc");
+      free(health);
+      return(NULL);
+    }
+
+  pthread_mutex_init(&health->lock, NULL);
+  pthread_cond_init(&health->cond, NULL);
+
+  if ( (err = pthread_create(&health->thread, NULL, worker, health)) != 0 )
+    {
+      fprintf(stderr, FUNC_NAME ": pthread_create: %s\n", strerror(err));
+      pthread_cond_destroy(&health->cond);
+      pthread_mutex_destroy(&health->lock);
+      free(health->ring);
+      free(health);
+      return(NULL);
+    }
+
+  return(health);
+}
+#undef FUNC_NAME
+
+/*
+  queue output for testing.
+    returns 0 once the worker has declared the stream broken,
+    so callers can stop handing it out.
+*/
+int rndbbs_health_feed(rndbbs_health_t *health,
+		       const unsigned char *buf, size_t nbytes)
+{
+  int ok;
+
+  pthread_mutex_lock(&health->lock);
+  while ( (nbytes > 0) && !health->stats.failed )
+    {
+      size_t tail, n;
+
+      while (health->count == RNDBBS_HEALTH_QUEUE)
+	pthread_cond_wait(&health->cond, &health->lock);
+
+      tail = (health->head + health->count) % RNDBBS_HEALTH_QUEUE;
+      n = RNDBBS_HEALTH_BLOCK - health->fill;
+      if (n > nbytes)
+	n = nbytes;
+
+      /* the block at tail is ours until it is queued, copy unlocked */
+      pthread_mutex_unlock(&health->lock);
+      memcpy(health->ring[tail] + health->fill, buf, n);
+      pthread_mutex_lock(&health->lock);
+
+      health->fill += n;
+      buf += n;
+      nbytes -= n;
+
+      if (health->fill == RNDBBS_HEALTH_BLOCK)
+	{
+	  health->fill = 0;
+	  health->count++;
+	  pthread_cond_broadcast(&health->cond);
+	}
+    }
+  ok = !health->stats.failed;
+  pthread_mutex_unlock(&health->lock);
+
+  return(ok);
+}
+
+/*
+  test whatever is still queued, stop the worker and free everything.
+    a trailing partial block is not tested.
+    returns 1 if the stream passed.
+*/
+int rndbbs_health_finish(rndbbs_health_t *health, rndbbs_health_stats_t *stats)
+{
+  int ok;
+
+  pthread_mutex_lock(&health->lock);
+  health->done = 1;
+  pthread_cond_broadcast(&health->cond);
+  pthread_mutex_unlock(&health->lock);
+
+  pthread_join(health->thread, NULL);
+
+  ok = !health->stats.failed;
+  if (stats != NULL)
+    memcpy(stats, &health->stats, sizeof(rndbbs_health_stats_t));
+
+  pthread_cond_destroy(&health->cond);
+  pthread_mutex_destroy(&health->lock);
+  free(health->ring);
+  free(health);
+
+  return(ok);
+}
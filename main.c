@@ -24,18 +24,32 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
 
 #include "gmpbbs.h"
+#include "output.h"
+#include "streams.h"
 
 void usage (const char *me)
 {
   fprintf(stderr,
-	  "usage: %s [-hX] [-o outfile] [-b base] [-k key_bitlen]\n"
-	  "      \t[-p prime] [-q prime] [-x initial] <# of randoms>\n\n"
+	  "usage: %s [-hPTX] [-o outfile] [-b base] [-k key_bitlen]\n"
+	  "      \t[-p prime] [-q prime] [-x initial] [--stats[=secs]]\n"
+	  "      \t<# of randoms>\n"
+	  "       %s --encrypt|--decrypt [-K keyfile] [-j jobs] -o outfile\n"
+	  "      \t<infile>\n"
+	  "       %s --streams N [-sTX] [-k key_bitlen] [-j jobs]\n"
+	  "      \t-o name%%02d.bin <# of bytes per stream>\n\n"
 	  "   -h, --help    :\tthis help message\n"
 	  "   -o, --output  :\tfile to write output to\n"
 	  "   -B, --binary  :\toutput as bytes\n"
 	  "   -H, --hex     :\toutput as hexidecimal digits\n"
+	  "   -F, --float   :\toutput as uniform doubles in [0,1)\n"
 	  "   -b, --base    :\tnumber base to use for output\n"
 	  "   -k, --keylen  :\trequested key length (k>=%d) (default 1024)\n"
 	  "   -s, --slow    :\tdon't use the improved (fast) algorithm\n"
@@ -43,8 +57,62 @@ void usage (const char *me)
 	  "   -p            :\tprime p = 3 (mod 4)\n"
 	  "   -q            :\tprime q = 3 (mod 4)\n"
 	  "   -x            :\tinitial x (to generate x0) (gcd(pq,x)=1)\n"
+	  "   -S, --stats   :\tprint a run summary to stderr, and the\n"
+	  "                 \tthroughput every secs seconds if given\n"
+	  "                 \t(not with --streams, --encrypt/--decrypt,\n"
+	  "                 \tor -b unless built with GMPBBS_RANDINT_CHUNK)\n"
+	  "   -P, --profile :\twith --stats, also time every squaring\n"
+	  "                 \t(two clock reads each, slows generation)\n"
+	  "   -T, --health  :\tcontinuously test the output (FIPS 140-2),\n"
+	  "                 \tand abort if it stops looking random\n"
 	  "   # of randoms  :\tthe number of random integers to generate\n"
-	  , me, GMPBBS_MINKEYLEN);
+	  "   -E, --encrypt :\tencrypt infile (a new key is made and written\n"
+	  "                 \tto the keyfile if it doesn't exist yet)\n"
+	  "   -D, --decrypt :\tdecrypt infile, needs the key it was encrypted with\n"
+	  "   -K, --keyfile :\tfile holding p and q for --encrypt/--decrypt\n"
+	  "   -j, --jobs    :\tthreads for --encrypt/--decrypt/--streams\n"
+	  "                 \t(default: CPUs)\n"
+	  "   -N, --streams :\twrite N independently keyed binary streams,\n"
+	  "                 \tto the files (or FIFOs) named by the -o\n"
+	  "                 \ttemplate, with one %%d for the stream number\n"
+	  , me, me, me, GMPBBS_MINKEYLEN);
+}
+
+/* where the time went, from rndbbs_get_stats() plus our own output I/O */
+static void print_stats(rndbbs_t *bbs, double t_total, double t_io,
+			unsigned long long nout)
+{
+  rndbbs_stats_t st;
+
+  rndbbs_get_stats(bbs, &st);
+
+  fprintf(stderr,
+	  "gmpbbs: key generation : %.6f s "
+	  "(prime search %.6f s, %llu candidates, %llu primality tests)\n"
+	  "gmpbbs: seeding        : %.6f s\n"
+	  "gmpbbs: entropy read   : %llu bytes in %.6f s\n"
+	  "gmpbbs: generation     : %.6f s, %llu squarings\n",
+	  st.ns_keygen / 1e9, st.ns_prime / 1e9,
+	  st.prime_candidates, st.prime_tests,
+	  st.ns_seed / 1e9,
+	  st.entropy_bytes, st.ns_entropy / 1e9,
+	  st.ns_generate / 1e9, st.squarings);
+  if (bbs->profile)
+    fprintf(stderr,
+	    "gmpbbs:   squaring     : %.6f s (%.1f ns each)\n"
+	    "gmpbbs:   extraction   : %.6f s\n",
+	    st.ns_square / 1e9,
+	    st.squarings ? (double) st.ns_square / st.squarings : 0.0,
+	    (st.ns_generate - st.ns_square) / 1e9);
+  fprintf(stderr,
+	  "gmpbbs: bits           : %llu extracted, %llu discarded\n"
+	  "gmpbbs: whitening      : %llu bytes in %.6f s\n"
+	  "gmpbbs: output I/O     : %.6f s\n"
+	  "gmpbbs: total          : %.6f s, %llu bytes out (%.1f B/s)\n",
+	  st.bits_extracted, st.bits_discarded,
+	  st.whiten_bytes, st.ns_whiten / 1e9,
+	  t_io,
+	  t_total, nout, (t_total > 0) ? nout / t_total : 0.0);
 }
 
 int main(int argc, char **argv)
@@ -57,6 +125,17 @@ int main(int argc, char **argv)
   int representation = 256;
   unsigned int nbytes;
   char *pstr=NULL, *qstr=NULL, *xstr=NULL;
+  int stats = 0;
+  int health = 0;
+  double stats_interval = 0;
+  int cipher = 0; /* 'E'ncrypt or 'D'ecrypt */
+  char *key_fn = NULL;
+  unsigned int jobs = 0;
+  unsigned int nstreams = 0;
+  double t_start = gmpbbs_now(), t_io = 0;
+  unsigned long long nout = 0;
+  gmpbbs_output_t out;
+  int ret = 0, ok;
 
   int opt, option_index=0;
 
@@ -67,16 +146,26 @@ int main(int argc, char **argv)
       { "output", 1, NULL, 'o' },
       { "binary", 0, NULL, 'B' },
       { "hex", 0, NULL, 'H' },
+      { "float", 0, NULL, 'F' },
       { "base64", 0, NULL, 'M' },
       { "base", 1, NULL, 'b' },
       { "keylen", 1, NULL, 'k' },
       { "slow", 0, NULL, 's' },
       { "xor", 0, NULL, 'X' },
+      { "stats", 2, NULL, 'S' },
+      { "profile", 0, NULL, 'P' },
+      { "health", 0, NULL, 'T' },
+      { "encrypt", 0, NULL, 'E' },
+      { "decrypt", 0, NULL, 'D' },
+      { "keyfile", 1, NULL, 'K' },
+      { "jobs", 1, NULL, 'j' },
+      { "streams", 1, NULL, 'N' },
       { "help", 0, NULL, 'h' },
+      { NULL, 0, NULL, 0 }
     };
 
   while ((opt =
-	  getopt_long(argc, argv, "BHMsXho:k:b:p:q:x:",
+	  getopt_long(argc, argv, "BHFMsXhTEDPS::o:k:b:p:q:x:K:j:N:",
 		      long_options, &option_index)) != -1)
     {
       switch(opt)
@@ -95,6 +184,10 @@ int main(int argc, char **argv)
 	case 'H':
 	  representation=16;
 	  break;
+	case 'F':
+	  /* not a base, uniform doubles */
+	  representation=0;
+	  break;
 	case 'M':
 	  representation=64;
 	  break;
@@ -132,6 +225,45 @@ int main(int argc, char **argv)
 	case 'X':
 	  bbs->xor_urandom = 1;
 	  break;
+	case 'T':
+	  health = 1;
+	  break;
+	case 'E':
+	case 'D':
+	  cipher = opt;
+	  break;
+	case 'K':
+	  key_fn = optarg;
+	  break;
+	case 'j':
+	  jobs = atoi(optarg);
+	  break;
+	case 'N':
+	  if (atoi(optarg) < 1)
+	    {
+	      usage(argv[0]);
+	      rndbbs_destroy(bbs);
+	      return(1);
+	    }
+	  nstreams = atoi(optarg);
+	  break;
+	case 'P':
+	  stats = 1;
+	  bbs->profile = 1;
+	  break;
+	case 'S':
+	  stats = 1;
+	  if (optarg != NULL)
+	    {
+	      stats_interval = atof(optarg);
+	      if (stats_interval <= 0)
+		{
+		  usage(argv[0]);
+		  rndbbs_destroy(bbs);
+		  return(1);
+		}
+	    }
+	  break;
 	default:
 	  usage(argv[0]);
 	  rndbbs_destroy(bbs);
@@ -145,6 +277,98 @@ int main(int argc, char **argv)
       usage(argv[0]);
       return(1);
     }
+
+  if ( (pstr != NULL) && (qstr != NULL) )
+    {
+      mpz_t p, q;
+      int ok;
+
+      mpz_init_set_str(p, pstr, 0);
+      mpz_init_set_str(q, qstr, 0);
+      ok = rndbbs_set_key(bbs, p, q);
+      mpz_clear(p);
+      mpz_clear(q);
+
+      if (!ok)
+	{
+	  usage(argv[0]);
+	  rndbbs_destroy(bbs);
+	  return(1);
+	}
+    }
+  else if ( (pstr != NULL) || (qstr != NULL) )
+    {
+      usage(argv[0]);
+      rndbbs_destroy(bbs);
+      return(1);
+    }
+
+  if (cipher)
+    {
+#ifdef _WIN32
+      fprintf(stderr, "%s: --encrypt/--decrypt not available here\n",
+	      argv[0]);
+      ret = 1;
+#else
+      if ( (out_fn == NULL) || bbs->xor_urandom || (stats_interval > 0) )
+	{
+	  usage(argv[0]);
+	  rndbbs_destroy(bbs);
+	  return(1);
+	}
+
+      /* a key from -p/-q, or the key file, made for a first --encrypt */
+      if (pstr == NULL)
+	{
+	  if (key_fn == NULL)
+	    {
+	      fprintf(stderr, "%s: --encrypt/--decrypt need -K or -p/-q\n",
+		      argv[0]);
+	      rndbbs_destroy(bbs);
+	      return(1);
+	    }
+	  if ( (cipher == 'E') && (access(key_fn, F_OK) != 0) )
+	    ret = !( rndbbs_gen_blumint(bbs, keylen) &&
+		     rndbbs_key_save(bbs, key_fn) );
+	  else
+	    ret = !rndbbs_key_load(bbs, key_fn);
+	}
+
+      if ( (ret == 0) && (cipher == 'E') )
+	{
+	  if (xstr != NULL)
+	    {
+	      mpz_t x;
+
+	      mpz_init_set_str(x, xstr, 0);
+	      ret = !rndbbs_set_x(bbs, x);
+	      mpz_clear(x);
+	    }
+	  else
+	    {
+	      ret = !rndbbs_gen_x(bbs);
+	    }
+	  if (ret == 0)
+	    ret = !rndbbs_encrypt_file(bbs, argv[optind], out_fn, jobs);
+	}
+      else if (ret == 0)
+	{
+	  ret = !rndbbs_decrypt_file(bbs, argv[optind], out_fn, jobs);
+	}
+
+      if (stats)
+	{
+	  struct stat st;
+
+	  if (stat(out_fn, &st) == 0)
+	    nout = st.st_size;
+	  print_stats(bbs, gmpbbs_now() - t_start, 0, nout);
+	}
+#endif /* _WIN32 */
+      rndbbs_destroy(bbs);
+      return(ret);
+    }
+
   nbytes = atoi(argv[optind]);
   if (nbytes < 1)
     {
@@ -153,63 +377,81 @@ int main(int argc, char **argv)
       return(1);
     }
 
-  if ( (pstr != NULL) && (qstr != NULL) )
+  /* with a single rndbbs_randint() call there is no progress to report */
+  if ( (stats_interval > 0) && (GMPBBS_RANDINT_CHUNK == 0) &&
+       (representation != 256) && (representation != 16) &&
+       (representation != 0) )
     {
-      mpz_t p, q;
+      usage(argv[0]);
+      rndbbs_destroy(bbs);
+      return(1);
+    }
 
-      mpz_init_set_str(p, pstr, 0);
-      mpz_init_set_str(q, qstr, 0);
+  if (nstreams > 0)
+    {
+      gmpbbs_streams_t conf;
 
-      if ( (mpz_probab_prime_p(p, MPZ_PROBAB_PRIME_REPS) && mpz_tstbit(p,1)) &&
-	   (mpz_probab_prime_p(q, MPZ_PROBAB_PRIME_REPS) && mpz_tstbit(q,1)) )
-	{
-	  mpz_mul(bbs->blumint, p, q);
-	  bbs->key_bitlen = mpz_sizeinbase(bbs->blumint, 2);
-	}
-      else
+      /* binary only, and every stream makes its own key */
+      if ( (out_fn == NULL) || !gmpbbs_streams_check_template(out_fn) ||
+	   (representation != 256) || (pstr != NULL) || (xstr != NULL) ||
+	   (stats_interval > 0) )
 	{
 	  usage(argv[0]);
 	  rndbbs_destroy(bbs);
 	  return(1);
 	}
 
+      conf.tmpl = out_fn;
+      conf.nstreams = nstreams;
+      conf.nbytes = nbytes;
+      conf.key_bitlen = keylen;
+      conf.health = health;
+      conf.nthreads = jobs;
+
+      ret = !gmpbbs_streams(bbs, &conf);
+      if (stats)
+	print_stats(bbs, gmpbbs_now() - t_start, 0,
+		    (unsigned long long) nstreams * nbytes);
+
+      rndbbs_destroy(bbs);
+      return(ret);
+    }
+
+  if (pstr != NULL)
+    {
       if (xstr != NULL)
 	{
-	  mpz_t tmpgcd;
+	  mpz_t x;
+	  int ok;
 
-	  mpz_init_set_str(bbs->x, xstr, 0);
+	  mpz_init_set_str(x, xstr, 0);
+	  ok = rndbbs_set_x(bbs, x);
+	  mpz_clear(x);
 
-	  mpz_init(tmpgcd);
-	  mpz_gcd(tmpgcd, bbs->blumint, bbs->x);
-	  if (mpz_cmp_ui(tmpgcd, 1) != 0)
+	  if (!ok)
 	    {
-	      mpz_clear(tmpgcd);
 	      usage(argv[0]);
 	      rndbbs_destroy(bbs);
 	      return(1);
 	    }
-	  mpz_clear(tmpgcd);
-
-	  /* x[0] = x^2 (mod n) */
-	  mpz_powm_ui(bbs->x, bbs->x, 2, bbs->blumint);
 	}
       else
 	{
 	  rndbbs_gen_x(bbs);
 	}
     }
-  else if ( (pstr != NULL) || (qstr != NULL) )
-    {
-      usage(argv[0]);
-      rndbbs_destroy(bbs);
-      return(1);
-    }
   else
     {
       rndbbs_gen_blumint(bbs, keylen);
       rndbbs_gen_x(bbs);
     }
 
+  if ( health && ((bbs->health = rndbbs_health_new()) == NULL) )
+    {
+      rndbbs_destroy(bbs);
+      return(1);
+    }
+
   if (out_fn != NULL)
     {
 #ifdef _WIN32
@@ -230,101 +472,60 @@ int main(int argc, char **argv)
 	}
     }
 
+  gmpbbs_output_init(&out, outf);
+  out.t_start = t_start;
+  out.stats_interval = stats_interval;
+
   switch(representation)
     {
       /* TODO: base64 */
     case 256:
-      {
-#ifndef WRITE_BLOCK_SIZE
-#define WRITE_BLOCK_SIZE 131072
-#endif
-	unsigned int incr_writed = 0;
-
-	while ( incr_writed < nbytes )
-	  {
-	    unsigned char *rnd;
-	    size_t nb = WRITE_BLOCK_SIZE;
-	    size_t nwritten;
-
-	    if ( (incr_writed + WRITE_BLOCK_SIZE) > nbytes )
-	      nb = (nbytes - incr_writed);
-
-	    rnd = (unsigned char *)
-	      rndbbs_randbytes(bbs, nb);
-
-	    if (rnd == NULL)
-	      {
-		perror("failed to generate bytes");
-		rndbbs_destroy(bbs);
-		return(1);
-	      }
-
-	    nwritten = fwrite(rnd, 1, nb, outf);
-	    incr_writed += nwritten;
-	    if ( nwritten != nb )
-	      perror("write short of block size");
-
-	    free(rnd);
-	  }
-	return(0);
-#undef WRITE_BLOCK_SIZE
-      }
+      ok = gmpbbs_output_binary(bbs, &out, nbytes);
+      break;
+    case 0:
+      ok = gmpbbs_output_float(bbs, &out, nbytes);
       break;
     case 16:
-      {
-	unsigned char *rnd;
-	int i;
-	char *rndstr;
-
-	rnd = (unsigned char *) rndbbs_randbytes(bbs, nbytes);
-	if (rnd == NULL)
-	  {
-	    perror("failed to generate bytes");
-	    rndbbs_destroy(bbs);
-	    return(1);
-	  }
-	if ( (rndstr = (char *) malloc(2*nbytes + 1)) == NULL )
-	  {
-	    perror("failed to generate bytes");
-	    free(rnd);
-	    rndbbs_destroy(bbs);
-	    return(1);
-	  }
-	for (i=0;i<nbytes;i++)
-	  {
-	    snprintf(rndstr+(2*i), 3, "%02x", rnd[i]);
-	  }
-	free(rnd);
-
-	fwrite(rndstr, 1, 2*nbytes, outf);
-
-	/* should this be like binary and skip \n? */
-	fprintf(outf, "\n");
-	free(rndstr);
-
-	return(0);
-      }
+      ok = gmpbbs_output_hex(bbs, &out, nbytes);
       break;
     default:
-      {
-	int i;
-	unsigned int *rndint;
-
-	rndint = rndbbs_randint(bbs, base, nbytes);
-	for (i=0;i<nbytes;i++)
-	  {
-	    fprintf(outf, "%d", rndint[i]);
-	    if (i != (nbytes-1))
-	      fprintf(outf, " ");
-	    else
-	      fprintf(outf, "\n");
-	  }
-	free(rndint);
-	rndbbs_destroy(bbs);
-	return(0);
-      }
+      ok = gmpbbs_output_int(bbs, &out, base, nbytes);
       break;
     }
 
-  return(0);
+  if (!ok)
+    {
+      rndbbs_destroy(bbs);
+      return(1);
+    }
+  t_io = out.t_io;
+  nout = out.nout;
+
+  if (fflush(outf) != 0)
+    {
+      perror("fflush");
+      ret = 1;
+    }
+
+  if (health)
+    {
+      rndbbs_health_stats_t hst;
+
+      if (!rndbbs_health_finish(bbs->health, &hst))
+	ret = 1;
+      bbs->health = NULL;
+
+      fprintf(stderr, "gmpbbs: health: %s, %llu blocks tested "
+	      "(%llu monobit, %llu poker, %llu runs, %llu autocorrelation "
+	      "failures)\n",
+	      hst.failed ? "FAILED" : "passed", hst.blocks,
+	      hst.monobit_fail, hst.poker_fail, hst.runs_fail,
+	      hst.autocorr_fail);
+    }
+
+  if (stats)
+    print_stats(bbs, gmpbbs_now() - t_start, t_io, nout);
+
+  rndbbs_destroy(bbs);
+  return(ret);
 }
@@ -0,0 +1,270 @@
+/* output.c: output encodings of the gmpbbs program
+
+  Copyright 2015 Maria Morisot.
+
+  This file is released under the GPL.
+
+  GMPBBS is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License,
+  or (at your option) any later version.
+
+  GMPBBS is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+  for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with GMPBBS; see the file LICENSE.  If not, write to
+  the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+  MA 02111-1307, USA.
+*/
+
+
+#include "output.h"
+
+/*
+  the output buffer.  big requests go through it in pieces, which
+    doesn't change the output, see next_bytes().
+*/
+#ifndef OUTBUF_SIZE
+#ifdef GMPBBS_LOWMEM
+#define OUTBUF_SIZE 4096
+#else
+#define OUTBUF_SIZE 131072
+#endif
+#endif
+
+/* doubles generated per rndbbs_rand_double() call for -F */
+#ifndef FLOAT_BLOCK_SIZE
+#ifdef GMPBBS_LOWMEM
+#define FLOAT_BLOCK_SIZE 256
+#else
+#define FLOAT_BLOCK_SIZE 4096
+#endif
+#endif
+
+/* bytes per rndbbs_fillbytes() call for -B, the output depends on it */
+#ifndef WRITE_BLOCK_SIZE
+#define WRITE_BLOCK_SIZE 131072
+#endif
+
+static unsigned char outbuf[OUTBUF_SIZE];
+
+double gmpbbs_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+void gmpbbs_output_init(gmpbbs_output_t *out, FILE *outf)
+{
+  out->outf = outf;
+  out->stats_interval = 0;
+  out->t_start = gmpbbs_now();
+  out->t_io = 0;
+  out->nout = 0;
+}
+
+/* --stats=secs: a throughput line every stats_interval seconds */
+static void progress(gmpbbs_output_t *out, double *t_report)
+{
+  if ( (out->stats_interval > 0) &&
+       (gmpbbs_now() - *t_report >= out->stats_interval) )
+    {
+      *t_report = gmpbbs_now();
+      fprintf(stderr, "gmpbbs: %llu bytes, %.1f B/s\n", out->nout,
+	      out->nout / (*t_report - out->t_start));
+    }
+}
+
+/*
+  the next n bytes of a rndbbs_fillbytes() call of *left bytes,
+    as if it had been made in one go.
+*/
+static int next_bytes(rndbbs_t *bbs, unsigned char *buf, size_t n,
+		      size_t *left)
+{
+  *left -= n;
+  if (*left == 0)
+    return(rndbbs_fillbytes(bbs, buf, n));
+
+  return(rndbbs_fillbytes_partial(bbs, buf, n));
+}
+
+int gmpbbs_output_binary(rndbbs_t *bbs, gmpbbs_output_t *out,
+			 unsigned int nbytes)
+{
+  unsigned int incr_writed = 0;
+  size_t left = 0;
+  double t_report = out->t_start;
+
+  while ( incr_writed < nbytes )
+    {
+      size_t nb = OUTBUF_SIZE;
+      size_t nwritten;
+      double t0;
+
+      if (left == 0)
+	{
+	  left = WRITE_BLOCK_SIZE;
+	  if ( (incr_writed + WRITE_BLOCK_SIZE) > nbytes )
+	    left = (nbytes - incr_writed);
+	}
+      if (nb > left)
+	nb = left;
+
+      if (!next_bytes(bbs, outbuf, nb, &left))
+	{
+	  perror("failed to generate bytes");
+	  return(0);
+	}
+
+      t0 = gmpbbs_now();
+      nwritten = fwrite(outbuf, 1, nb, out->outf);
+      out->t_io += gmpbbs_now() - t0;
+      incr_writed += nwritten;
+      out->nout += nwritten;
+      if ( nwritten != nb )
+	perror("write short of block size");
+
+      progress(out, &t_report);
+    }
+
+  return(1);
+}
+
+int gmpbbs_output_hex(rndbbs_t *bbs, gmpbbs_output_t *out,
+		      unsigned int nbytes)
+{
+  /* one rndbbs_fillbytes() call for all of it, half a buffer a time */
+  static const char hexdigit[] = "0123456789abcdef";
+  unsigned int incr_writed = 0;
+  size_t left = nbytes;
+  double t_report = out->t_start;
+
+  while ( incr_writed < nbytes )
+    {
+      size_t i, nb = OUTBUF_SIZE / 2;
+      double t0;
+
+      if (nb > left)
+	nb = left;
+
+      if (!next_bytes(bbs, outbuf, nb, &left))
+	{
+	  perror("failed to generate bytes");
+	  return(0);
+	}
+
+      /* in place, from the end: byte i becomes chars 2i, 2i+1 */
+      for (i=nb;i-->0;)
+	{
+	  unsigned char c = outbuf[i];
+
+	  outbuf[2*i] = hexdigit[c >> 4];
+	  outbuf[2*i+1] = hexdigit[c & 0xf];
+	}
+
+      t0 = gmpbbs_now();
+      fwrite(outbuf, 1, 2*nb, out->outf);
+      out->t_io += gmpbbs_now() - t0;
+      out->nout += 2*nb;
+      incr_writed += nb;
+
+      progress(out, &t_report);
+    }
+
+  /* should this be like binary and skip \n? */
+  fprintf(out->outf, "\n");
+
+  out->nout++;
+  return(1);
+}
+
+int gmpbbs_output_float(rndbbs_t *bbs, gmpbbs_output_t *out, unsigned int n)
+{
+  double rnd[FLOAT_BLOCK_SIZE];
+  unsigned int incr_writed = 0;
+  double t_report = out->t_start;
+
+  while ( incr_writed < n )
+    {
+      unsigned int i, nb = FLOAT_BLOCK_SIZE;
+      double t0;
+
+      if ( (incr_writed + FLOAT_BLOCK_SIZE) > n )
+	nb = (n - incr_writed);
+
+      if (!rndbbs_rand_double(bbs, rnd, nb))
+	{
+	  perror("failed to generate doubles");
+	  return(0);
+	}
+
+      t0 = gmpbbs_now();
+      for (i=0;i<nb;i++)
+	{
+	  /* %.17g round-trips every double */
+	  int len = fprintf(out->outf, "%.17g", rnd[i]);
+
+	  if (len > 0)
+	    out->nout += len + 1;
+	  if (incr_writed + i != (n-1))
+	    fprintf(out->outf, " ");
+	  else
+	    fprintf(out->outf, "\n");
+	}
+      out->t_io += gmpbbs_now() - t0;
+      incr_writed += nb;
+
+      progress(out, &t_report);
+    }
+
+  return(1);
+}
+
+int gmpbbs_output_int(rndbbs_t *bbs, gmpbbs_output_t *out, unsigned int base,
+		      unsigned int n)
+{
+  unsigned int incr_writed = 0;
+  double t_report = out->t_start;
+
+  while ( incr_writed < n )
+    {
+      unsigned int i, nb = n - incr_writed;
+      unsigned int *rndint;
+      double t0;
+
+      if ( (GMPBBS_RANDINT_CHUNK > 0) && (nb > GMPBBS_RANDINT_CHUNK) )
+	nb = GMPBBS_RANDINT_CHUNK;
+
+      rndint = rndbbs_randint(bbs, base, nb);
+      if (rndint == NULL)
+	{
+	  perror("failed to generate integers");
+	  return(0);
+	}
+      t0 = gmpbbs_now();
+      for (i=0;i<nb;i++)
+	{
+	  int len = fprintf(out->outf, "%d", rndint[i]);
+
+	  if (len > 0)
+	    out->nout += len + 1;
+	  if (incr_writed + i != (n-1))
+	    fprintf(out->outf, " ");
+	  else
+	    fprintf(out->outf, "\n");
+	}
+      out->t_io += gmpbbs_now() - t0;
+      incr_writed += nb;
+      free(rndint);
+
+      progress(out, &t_report);
+    }
+
+  return(1);
+}
@@ -0,0 +1,67 @@
+/* output.h: output encodings of the gmpbbs program
+
+  Copyright 2015 Maria Morisot.
+
+  This file is released under the GPL.
+
+  GMPBBS is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License,
+  or (at your option) any later version.
+
+  GMPBBS is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+  for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with GMPBBS; see the file LICENSE.  If not, write to
+  the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+  MA 02111-1307, USA.
+*/
+
+
+#ifndef _GMPBBS_OUTPUT_H
+#define _GMPBBS_OUTPUT_H 1
+
+#include "gmpbbs.h"
+
+/* numbers per rndbbs_randint() call for -b, 0 for all of them at once */
+#ifndef GMPBBS_RANDINT_CHUNK
+#ifdef GMPBBS_LOWMEM
+#define GMPBBS_RANDINT_CHUNK 64
+#else
+#define GMPBBS_RANDINT_CHUNK 0
+#endif
+#endif
+
+/*
+  where an output goes, and what it cost.  gmpbbs writes through these
+    and gmpbbs-bench times the very same code against /dev/null.
+*/
+typedef struct
+{
+  FILE *outf;
+  double stats_interval; /* seconds between progress lines, 0 for none */
+  double t_start; /* for the progress lines */
+  double t_io; /* seconds spent writing */
+  unsigned long long nout; /* bytes written */
+} gmpbbs_output_t;
+
+void gmpbbs_output_init(gmpbbs_output_t *out, FILE *outf);
+
+/* nbytes raw bytes, from rndbbs_fillbytes() calls of WRITE_BLOCK_SIZE */
+int gmpbbs_output_binary(rndbbs_t *bbs, gmpbbs_output_t *out,
+			 unsigned int nbytes);
+/* nbytes bytes as lowercase hex digits and a newline, one fillbytes call */
+int gmpbbs_output_hex(rndbbs_t *bbs, gmpbbs_output_t *out,
+		      unsigned int nbytes);
+/* n uniform doubles in [0,1), %.17g, space separated */
+int gmpbbs_output_float(rndbbs_t *bbs, gmpbbs_output_t *out, unsigned int n);
+/* n rndbbs_randint() numbers in [0,base), in decimal, space separated */
+int gmpbbs_output_int(rndbbs_t *bbs, gmpbbs_output_t *out, unsigned int base,
+		      unsigned int n);
+
+double gmpbbs_now(void);
+
+#endif /* _GMPBBS_OUTPUT_H */
@@ -0,0 +1,300 @@
+/* sample.c: shuffling and sampling for the GMPBBS Blum Blum Shub PRNG
+
+  Copyright 2015 Maria Morisot.
+
+  This file is released under the GPL.
+
+  GMPBBS is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License,
+  or (at your option) any later version.
+
+  GMPBBS is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+  for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with GMPBBS; see the file LICENSE.  If not, write to
+  the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+  MA 02111-1307, USA.
+*/
+
+/*
+  BBS output is expensive and memory is not, so every bounded draw
+  here takes the fewest reservoir bits that cover the bound and rejects
+  out of range values, rather than spending 32 or 64 bits per draw.
+*/
+
+
+#include "gmpbbs.h"
+
+#include <errno.h>
+
+/* indices drawn (and prefetched) ahead of the swaps in rndbbs_shuffle() */
+#ifndef RNDBBS_SHUFFLE_BATCH
+#define RNDBBS_SHUFFLE_BATCH 64
+#endif
+
+/* elements up to this size are swapped through a stack buffer */
+#define SWAP_BUF 256
+
+/* rndbbs_sample() uses Floyd's method when k * RNDBBS_FLOYD_RATIO <= n */
+#ifndef RNDBBS_FLOYD_RATIO
+#define RNDBBS_FLOYD_RATIO 4
+#endif
+
+/* uniform in [0,bound): rejection sampling on bitlen(bound-1) bits */
+static inline int _rndbbs_uniform(rndbbs_t *bbs, uint64_t bound, uint64_t *r)
+{
+  unsigned int bits;
+  uint64_t v;
+
+  if (bound <= 1)
+    {
+      *r = 0;
+      return(1);
+    }
+
+  bits = 64 - __builtin_clzll(bound - 1);
+  do
+    {
+      if (!rndbbs_randbits(bbs, &v, 1, bits))
+	return(0);
+    }
+  while (v >= bound);
+
+  *r = v;
+  return(1);
+}
+
+/* fill out[] with nmemb uniform integers in [0,bound) */
+int rndbbs_randrange(rndbbs_t *bbs, uint64_t *out, size_t nmemb,
+		     uint64_t bound)
+{
+  size_t i;
+
+  if (bound == 0)
+    return(0);
+
+  for (i=0;i<nmemb;i++)
+    if (!_rndbbs_uniform(bbs, bound, &out[i]))
+      return(0);
+
+  return(1);
+}
+
+static inline void swap_elem(unsigned char *a, unsigned char *b, size_t size)
+{
+  switch(size)
+    {
+    case 4:
+      {
+	uint32_t t;
+
+	memcpy(&t, a, 4);
+	memcpy(a, b, 4);
+	memcpy(b, &t, 4);
+      }
+      break;
+    case 8:
+      {
+	uint64_t t;
+
+	memcpy(&t, a, 8);
+	memcpy(a, b, 8);
+	memcpy(b, &t, 8);
+      }
+      break;
+    default:
+      {
+	unsigned char t[SWAP_BUF];
+
+	while (size > 0)
+	  {
+	    size_t n = (size > SWAP_BUF) ? SWAP_BUF : size;
+
+	    memcpy(t, a, n);
+	    memcpy(a, b, n);
+	    memcpy(b, t, n);
+	    a += n;
+	    b += n;
+	    size -= n;
+	  }
+      }
+      break;
+    }
+}
+
+/*
+  in-place Fisher-Yates shuffle of nmemb elements of size bytes.
+    the bounds for the next RNDBBS_SHUFFLE_BATCH steps are known in
+    advance, so we draw those indices first and prefetch their elements;
+    on big arrays the swaps then wait on memory in parallel.
+*/
+int rndbbs_shuffle(rndbbs_t *bbs, void *base, size_t nmemb, size_t size)
+{
+  unsigned char *a = (unsigned char *) base;
+  uint64_t j[RNDBBS_SHUFFLE_BATCH];
+  size_t i = nmemb;
+
+  while (i > 1)
+    {
+      size_t b, n = (i - 1 > RNDBBS_SHUFFLE_BATCH) ?
+	RNDBBS_SHUFFLE_BATCH : i - 1;
+
+      /* step b swaps element i-1-b with one of 0..i-1-b */
+      for (b=0;b<n;b++)
+	{
+	  if (!_rndbbs_uniform(bbs, i - b, &j[b]))
+	    return(0);
+	  __builtin_prefetch(a + j[b] * size, 1);
+	}
+
+      for (b=0;b<n;b++)
+	if (j[b] != i - 1 - b)
+	  swap_elem(a + (i - 1 - b) * size, a + j[b] * size, size);
+
+      i -= n;
+    }
+
+  return(1);
+}
+
+/* perm[] = a uniformly random permutation of 0..n-1 (inside-out shuffle) */
+int rndbbs_permutation(rndbbs_t *bbs, size_t *perm, size_t n)
+{
+  size_t i;
+
+  for (i=0;i<n;i++)
+    {
+      uint64_t j;
+
+      if (!_rndbbs_uniform(bbs, i + 1, &j))
+	return(0);
+      if (j != i)
+	perm[i] = perm[j];
+      perm[j] = i;
+    }
+
+  return(1);
+}
+
+/* open addressing set of size_t, for Floyd's method */
+typedef struct
+{
+  size_t *slot;
+  size_t mask;
+} idxset_t;
+
+#define IDXSET_EMPTY ((size_t) -1)
+
+static int idxset_insert(idxset_t *set, size_t v)
+{
+  /* multiplicative hashing, the low bits of v alone cluster badly */
+  size_t h = (size_t) ((v * 0x9e3779b97f4a7c15ULL) >> 17) & set->mask;
+
+  while (set->slot[h] != IDXSET_EMPTY)
+    {
+      if (set->slot[h] == v)
+	return(0);
+      h = (h + 1) & set->mask;
+    }
+  set->slot[h] = v;
+
+  return(1);
+}
+
+/*
+  k distinct integers out of 0..n-1, uniformly, in no particular order
+  (rndbbs_shuffle() them if order matters).
+    for k much smaller than n, Floyd's method needs k draws and O(k)
+    memory; otherwise a partial Fisher-Yates over 0..n-1 is cheaper.
+*/
+int rndbbs_sample(rndbbs_t *bbs, size_t *out, size_t k, size_t n)
+#define FUNC_NAME "rndbbs_sample"
+{
+  size_t i;
+
+  if (k > n)
+    return(0);
+
+  /* Floyd only ever stores values below n, never IDXSET_EMPTY */
+  if (k <= n / RNDBBS_FLOYD_RATIO)
+    {
+      idxset_t set;
+      size_t nslots = 2;
+
+      /* keep the set at most half full */
+      while (nslots < 2 * k)
+	nslots <<= 1;
+
+      if ( (set.slot = (size_t *) malloc(nslots * sizeof(size_t))) == NULL )
+	{
+	  perror(FUNC_NAME ": malloc");
+	  return(0);
+	}
+      memset(set.slot, 0xff, nslots * sizeof(size_t));
+      set.mask = nslots - 1;
+
+      /* for j = n-k..n-1: take t in 0..j, or j itself if t was taken */
+      for (i=0;i<k;i++)
+	{
+	  size_t j = n - k + i;
+	  uint64_t t;
+
+	  if (!_rndbbs_uniform(bbs, (uint64_t) j + 1, &t))
+	    {
+	      free(set.slot);
+	      return(0);
+	    }
+	  if (!idxset_insert(&set, t))
+	    {
+	      idxset_insert(&set, j);
+	      t = j;
+	    }
+	  out[i] = t;
+	}
+
+      free(set.slot);
+      return(1);
+    }
+  else
+    {
+      size_t *pool;
+
+      if (n > SIZE_MAX / sizeof(size_t))
+	{
+	  errno = ENOMEM;
+	  return(0);
+	}
+      if ( (pool = (size_t *) malloc(n * sizeof(size_t))) == NULL )
+	{
+	  perror(FUNC_NAME ": malloc");
+	  return(0);
+	}
+      for (i=0;i<n;i++)
+	pool[i] = i;
+
+      /* the first k steps of a Fisher-Yates shuffle */
+      for (i=0;i<k;i++)
+	{
+	  uint64_t j;
+	  size_t t;
+
+	  if (!_rndbbs_uniform(bbs, n - i, &j))
+	    {
+	      free(pool);
+	      return(0);
+	    }
+	  t = pool[i + j];
+	  pool[i + j] = pool[i];
+	  pool[i] = t;
+	  out[i] = t;
+	}
+
+      free(pool);
+      return(1);
+    }
+}
+#undef FUNC_NAME
@@ -0,0 +1,657 @@
+/* streams.c: multi-stream output for the GMPBBS Blum Blum Shub PRNG
+
+  Copyright 2015 Maria Morisot.
+
+  This file is released under the GPL.
+
+  GMPBBS is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License,
+  or (at your option) any later version.
+
+  GMPBBS is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+  for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with GMPBBS; see the file LICENSE.  If not, write to
+  the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+  MA 02111-1307, USA.
+*/
+/*
+  N independent generators, each writing its own file (or FIFO).
+    a pool of threads does the CPU work, keying a stream and generating
+    its next STREAM_BLOCK_SIZE block; the calling thread does all the
+    I/O, with non-blocking opens and writes driven by poll().  so a FIFO
+    nobody reads yet, or whose reader is busy with another stream, never
+    holds up a pool thread: streams are only handed to the pool when
+    their output can take more, and every output makes progress in
+    whatever order they are read.
+
+    a stream goes KEY -> (pool) -> OPEN -> READY -> GEN -> (pool) ->
+    WRITE -> READY ... -> DONE.  only streams in GEN or WRITE hold a
+    block buffer.
+*/
+
+
+#include "streams.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+#ifndef O_NONBLOCK
+#define O_NONBLOCK 0
+#endif
+
+#ifndef STREAM_BLOCK_SIZE
+#ifdef GMPBBS_LOWMEM
+#define STREAM_BLOCK_SIZE 8192
+#else
+#define STREAM_BLOCK_SIZE 131072
+#endif
+#endif
+
+/* how often to retry opening a FIFO that has no reader yet */
+#define STREAM_RETRY_MS 10
+
+enum { S_KEY, S_OPEN, S_READY, S_GEN, S_WRITE, S_DONE };
+
+typedef struct
+{
+  int state;
+  int ok; /* result of the last pool step */
+  rndbbs_t *bbs; /* NULL until keyed */
+  int fd;
+  uint64_t done; /* bytes written */
+  unsigned char *buf;
+  size_t len, off; /* the block in buf, and how much of it is written */
+  char *name; /* the expanded template */
+} stream_t;
+
+typedef struct
+{
+  rndbbs_t *proto; /* settings, and where the stats are summed up */
+  const gmpbbs_streams_t *conf;
+  stream_t *streams;
+
+  /* streams in KEY or GEN waiting for a thread, a ring of nstreams */
+  unsigned int *queue;
+  unsigned int head, count;
+  unsigned int active; /* streams not finished yet */
+  int failed;
+  int stop;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+#ifndef _WIN32
+  int wake[2]; /* the pool tells the I/O loop a stream changed state */
+#endif
+} pool_t;
+
+/*
+  a template must have exactly one integer conversion, %d, %u, %x
+    or %o, optionally with a 0 flag and a width; %% is a literal %.
+*/
+int gmpbbs_streams_check_template(const char *tmpl)
+{
+  const char *p;
+  int nconv = 0;
+
+  for (p=tmpl;*p;p++)
+    {
+      if (*p != '%')
+	continue;
+
+      p++;
+      if (*p == '%')
+	continue;
+      while ( (*p >= '0') && (*p <= '9') )
+	p++;
+      if ( (*p != 'd') && (*p != 'u') && (*p != 'x') && (*p != 'o') )
+	return(0);
+      nconv++;
+    }
+
+  return(nconv == 1);
+}
+
+/* (pool) key the stream */
+static int stream_key(pool_t *pool, stream_t *s)
+#define FUNC_NAME "stream_key"
+{
+  rndbbs_t *bbs;
+
+  if ( (bbs = rndbbs_new()) == NULL )
+    return(0);
+  bbs->improved = pool->proto->improved;
+  bbs->xor_urandom = pool->proto->xor_urandom;
+  bbs->profile = pool->proto->profile;
+  s->bbs = bbs;
+
+  if ( !rndbbs_gen_blumint(bbs, pool->conf->key_bitlen) ||
+       !rndbbs_gen_x(bbs) )
+    {
+      fprintf(stderr, FUNC_NAME ": %s: key generation failed\n", s->name);
+      return(0);
+    }
+
+  if ( pool->conf->health &&
+       ((bbs->health = rndbbs_health_new()) == NULL) )
+    return(0);
+
+  return(1);
+}
+#undef FUNC_NAME
+
+/* (pool) generate the stream's next block */
+static int stream_fill(pool_t *pool, stream_t *s)
+#define FUNC_NAME "stream_fill"
+{
+  size_t n = STREAM_BLOCK_SIZE;
+
+  if (pool->conf->nbytes - s->done < n)
+    n = pool->conf->nbytes - s->done;
+
+  if ( (s->buf = (unsigned char *) malloc(n)) == NULL )
+    {
+      perror(FUNC_NAME ": malloc");
+      return(0);
+    }
+  s->len = n;
+  s->off = 0;
+
+  return(rndbbs_fillbytes(s->bbs, s->buf, n));
+}
+#undef FUNC_NAME
+
+/*
+  (I/O) open the stream's output without blocking.
+    returns 1 if open, -1 if it is a FIFO with no reader yet, 0 on error.
+*/
+static int stream_open(stream_t *s)
+#define FUNC_NAME "stream_open"
+{
+  s->fd = open(s->name, O_WRONLY|O_CREAT|O_TRUNC|O_BINARY|O_NONBLOCK, 0666);
+  if (s->fd != -1)
+    return(1);
+
+#ifdef ENXIO
+  if (errno == ENXIO)
+    return(-1);
+#endif
+  perror(FUNC_NAME ": open");
+  return(0);
+}
+#undef FUNC_NAME
+
+/*
+  (I/O) write as much of the stream's block as the output takes.
+    returns 0 on error; s->off == s->len once the block is out.
+*/
+static int stream_write(stream_t *s)
+#define FUNC_NAME "stream_write"
+{
+  while (s->off < s->len)
+    {
+      ssize_t w = write(s->fd, s->buf + s->off, s->len - s->off);
+
+      if (w == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  if (errno == EAGAIN)
+	    return(1);
+	  /* the reader went away */
+	  if (errno == EPIPE)
+	    fprintf(stderr, FUNC_NAME ": %s: reader closed after %llu bytes\n",
+		    s->name, (unsigned long long) (s->done + s->off));
+	  else
+	    perror(FUNC_NAME ": write");
+	  return(0);
+	}
+      s->off += w;
+    }
+
+  return(1);
+}
+#undef FUNC_NAME
+
+/* (I/O) close up a stream, ok or not; its stats go to the proto generator */
+static int stream_finish(pool_t *pool, stream_t *s)
+#define FUNC_NAME "stream_finish"
+{
+  int ok = 1;
+
+  if ( (s->fd != -1) && (close(s->fd) == -1) )
+    {
+      perror(FUNC_NAME ": close");
+      ok = 0;
+    }
+  s->fd = -1;
+  free(s->buf);
+  s->buf = NULL;
+  s->state = S_DONE;
+
+  if (s->bbs == NULL)
+    return(ok);
+
+  if (s->bbs->health != NULL)
+    {
+      rndbbs_health_stats_t hst;
+
+      if (!rndbbs_health_finish(s->bbs->health, &hst))
+	{
+	  fprintf(stderr, FUNC_NAME ": %s: health check FAILED\n", s->name);
+	  ok = 0;
+	}
+      s->bbs->health = NULL;
+    }
+
+  {
+    rndbbs_stats_t *d = &pool->proto->stats, *st = &s->bbs->stats;
+
+    d->squarings += st->squarings;
+    d->bits_extracted += st->bits_extracted;
+    d->bits_discarded += st->bits_discarded;
+    d->prime_candidates += st->prime_candidates;
+    d->prime_tests += st->prime_tests;
+    d->entropy_bytes += st->entropy_bytes;
+    d->whiten_bytes += st->whiten_bytes;
+    d->ns_keygen += st->ns_keygen;
+    d->ns_prime += st->ns_prime;
+    d->ns_seed += st->ns_seed;
+    d->ns_entropy += st->ns_entropy;
+    d->ns_generate += st->ns_generate;
+    d->ns_square += st->ns_square;
+    d->ns_whiten += st->ns_whiten;
+  }
+
+  rndbbs_destroy(s->bbs);
+  s->bbs = NULL;
+
+  return(ok);
+}
+#undef FUNC_NAME
+
+/* (I/O, pool->lock held) finish s, it is the last we hear of it */
+static void stream_end(pool_t *pool, stream_t *s, int ok)
+{
+  if (!stream_finish(pool, s) || !ok)
+    pool->failed = 1;
+  pool->active--;
+}
+
+/* (pool->lock held) hand s to the pool for its next step */
+static void stream_queue(pool_t *pool, unsigned int i, int state)
+{
+  pool->streams[i].state = state;
+  pool->queue[(pool->head + pool->count) % pool->conf->nstreams] = i;
+  pool->count++;
+  pthread_cond_broadcast(&pool->cond);
+}
+
+/* (pool) tell the I/O loop that a stream changed state */
+static void stream_wake(pool_t *pool)
+{
+#ifdef _WIN32
+  pthread_cond_broadcast(&pool->cond);
+#else
+  char c = 0;
+
+  /* if the pipe is full, the I/O loop is due to wake anyway */
+  while ( (write(pool->wake[1], &c, 1) == -1) && (errno == EINTR) )
+    ;
+#endif
+}
+
+static void *stream_worker(void *arg)
+{
+  pool_t *pool = (pool_t *) arg;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;)
+    {
+      unsigned int i;
+      stream_t *s;
+      int ok;
+
+      while ( (pool->count == 0) && !pool->stop )
+	pthread_cond_wait(&pool->cond, &pool->lock);
+      if (pool->stop)
+	break;
+
+      i = pool->queue[pool->head];
+      pool->head = (pool->head + 1) % pool->conf->nstreams;
+      pool->count--;
+      pthread_mutex_unlock(&pool->lock);
+
+      s = &pool->streams[i];
+      if (s->state == S_KEY)
+	ok = stream_key(pool, s);
+      else
+	ok = stream_fill(pool, s);
+
+      pthread_mutex_lock(&pool->lock);
+      s->ok = ok;
+      s->state = (s->state == S_KEY) ? S_OPEN : S_WRITE;
+      stream_wake(pool);
+    }
+  pthread_mutex_unlock(&pool->lock);
+
+  return(NULL);
+}
+
+/*
+  (pool->lock held) open the outputs of newly keyed streams, and list
+    in idx[] the streams waiting for their output to take more.
+    *retry is set if a FIFO has no reader yet.
+*/
+static unsigned int stream_scan(pool_t *pool, unsigned int *idx, int *retry)
+{
+  unsigned int i, n = 0;
+
+  *retry = 0;
+  for (i=0;i<pool->conf->nstreams;i++)
+    {
+      stream_t *s = &pool->streams[i];
+
+      if ( ((s->state == S_OPEN) || (s->state == S_WRITE)) && !s->ok )
+	{
+	  stream_end(pool, s, 0);
+	  continue;
+	}
+
+      if (s->state == S_OPEN)
+	switch (stream_open(s))
+	  {
+	  case 1:
+	    if (s->done == pool->conf->nbytes)
+	      stream_end(pool, s, 1);
+	    else
+	      s->state = S_READY;
+	    break;
+	  case -1:
+	    *retry = 1;
+	    break;
+	  default:
+	    stream_end(pool, s, 0);
+	    break;
+	  }
+
+      if ( (s->state == S_READY) || (s->state == S_WRITE) )
+	idx[n++] = i;
+    }
+
+  return(n);
+}
+
+/*
+  the I/O loop: open outputs, write finished blocks, and queue a stream
+    for its next block when its output can take more.  READY and WRITE
+    streams belong to this loop, so it writes without the lock.
+*/
+static void stream_io(pool_t *pool)
+#define FUNC_NAME "stream_io"
+{
+  unsigned int i, n = pool->conf->nstreams, nready;
+  unsigned int *idx;
+  unsigned char *go; /* idx[i]'s output can take more */
+  int retry, ok;
+#ifndef _WIN32
+  struct pollfd *pfd;
+
+  pfd = (struct pollfd *) malloc((n + 1) * sizeof(struct pollfd));
+#endif
+  idx = (unsigned int *) malloc(n * sizeof(unsigned int));
+  go = (unsigned char *) malloc(n);
+
+  ok = (idx != NULL) && (go != NULL);
+#ifndef _WIN32
+  ok = ok && (pfd != NULL);
+#endif
+
+  pthread_mutex_lock(&pool->lock);
+  if (!ok)
+    {
+      perror(FUNC_NAME ": malloc");
+      pool->failed = 1;
+      pool->active = 0;
+    }
+
+  while (pool->active > 0)
+    {
+      nready = stream_scan(pool, idx, &retry);
+      if (pool->active == 0)
+	break;
+
+#ifdef _WIN32
+      /* no FIFOs here: files always take more, so just wait for work */
+      if (nready == 0)
+	{
+	  pthread_cond_wait(&pool->cond, &pool->lock);
+	  continue;
+	}
+      pthread_mutex_unlock(&pool->lock);
+      memset(go, 1, nready);
+#else
+      for (i=0;i<nready;i++)
+	{
+	  pfd[i].fd = pool->streams[idx[i]].fd;
+	  pfd[i].events = POLLOUT;
+	  pfd[i].revents = 0;
+	}
+      pfd[nready].fd = pool->wake[0];
+      pfd[nready].events = POLLIN;
+      pfd[nready].revents = 0;
+      pthread_mutex_unlock(&pool->lock);
+
+      if ( (poll(pfd, nready + 1, retry ? STREAM_RETRY_MS : -1) == -1) &&
+	   (errno != EINTR) )
+	{
+	  perror(FUNC_NAME ": poll");
+	  pthread_mutex_lock(&pool->lock);
+	  pool->failed = 1;
+	  break;
+	}
+      if (pfd[nready].revents & POLLIN)
+	{
+	  char drain[64];
+
+	  while (read(pool->wake[0], drain, sizeof(drain)) > 0)
+	    ;
+	}
+      for (i=0;i<nready;i++)
+	go[i] = (pfd[i].revents != 0);
+#endif
+
+      for (i=0;i<nready;i++)
+	{
+	  stream_t *s = &pool->streams[idx[i]];
+
+	  if (go[i] && (s->state == S_WRITE))
+	    s->ok = stream_write(s);
+	}
+
+      pthread_mutex_lock(&pool->lock);
+      for (i=0;i<nready;i++)
+	{
+	  stream_t *s = &pool->streams[idx[i]];
+
+	  if (!go[i])
+	    continue;
+	  if (s->state == S_READY)
+	    stream_queue(pool, idx[i], S_GEN);
+	  else if (!s->ok)
+	    stream_end(pool, s, 0);
+	  else if (s->off == s->len)
+	    {
+	      s->done += s->len;
+	      free(s->buf);
+	      s->buf = NULL;
+	      if (s->done == pool->conf->nbytes)
+		stream_end(pool, s, 1);
+	      else
+		s->state = S_READY;
+	    }
+	}
+    }
+
+  /* let the pool go */
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+
+#ifndef _WIN32
+  free(pfd);
+#endif
+  free(idx);
+  free(go);
+}
+#undef FUNC_NAME
+
+/*
+  write conf->nstreams streams of conf->nbytes bytes each.
+    returns 1 if every stream was written in full.
+*/
+int gmpbbs_streams(rndbbs_t *bbs, const gmpbbs_streams_t *conf)
+#define FUNC_NAME "gmpbbs_streams"
+{
+  pool_t pool;
+  pthread_t *tid;
+  unsigned int i, nthreads = conf->nthreads, started;
+
+  if ( (conf->nstreams == 0) || !gmpbbs_streams_check_template(conf->tmpl) )
+    return(0);
+
+  if (nthreads == 0)
+    {
+#ifdef _SC_NPROCESSORS_ONLN
+      long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+      nthreads = (ncpu > 0) ? ncpu : 1;
+#else
+      nthreads = 1;
+#endif
+    }
+  if (nthreads > conf->nstreams)
+    nthreads = conf->nstreams;
+
+  pool.proto = bbs;
+  pool.conf = conf;
+  pool.head = 0;
+  pool.count = pool.active = conf->nstreams;
+  pool.failed = 0;
+  pool.stop = 0;
+  pool.streams = (stream_t *) malloc(conf->nstreams * sizeof(stream_t));
+  pool.queue = (unsigned int *) malloc(conf->nstreams * sizeof(unsigned int));
+  tid = (pthread_t *) malloc(nthreads * sizeof(pthread_t));
+  if ( (pool.streams == NULL) || (pool.queue == NULL) || (tid == NULL) )
+    {
+      perror(FUNC_NAME ": malloc");
+      free(pool.streams);
+      free(pool.queue);
+      free(tid);
+      return(0);
+    }
+
+#ifndef _WIN32
+  if (pipe(pool.wake) == -1)
+    {
+      perror(FUNC_NAME ": pipe");
+      free(pool.streams);
+      free(pool.queue);
+      free(tid);
+      return(0);
+    }
+  fcntl(pool.wake[0], F_SETFL, O_NONBLOCK);
+  fcntl(pool.wake[1], F_SETFL, O_NONBLOCK);
+#endif
+
+  for (i=0;i<conf->nstreams;i++)
+    {
+      stream_t *s = &pool.streams[i];
+      int len = snprintf(NULL, 0, conf->tmpl, i);
+
+      if ( (s->name = (char *) malloc(len + 1)) == NULL )
+	{
+	  perror(FUNC_NAME ": malloc");
+	  while (i-- > 0)
+	    free(pool.streams[i].name);
+#ifndef _WIN32
+	  close(pool.wake[0]);
+	  close(pool.wake[1]);
+#endif
+	  free(pool.streams);
+	  free(pool.queue);
+	  free(tid);
+	  return(0);
+	}
+      snprintf(s->name, len + 1, conf->tmpl, i);
+
+      s->state = S_KEY;
+      s->ok = 1;
+      s->bbs = NULL;
+      s->fd = -1;
+      s->done = 0;
+      s->buf = NULL;
+      s->len = s->off = 0;
+      pool.queue[i] = i;
+    }
+
+#ifdef SIGPIPE
+  /* a reader closing its FIFO ends that stream, not all of them */
+  signal(SIGPIPE, SIG_IGN);
+#endif
+
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.cond, NULL);
+
+  for (started=0;started<nthreads;started++)
+    if (pthread_create(&tid[started], NULL, stream_worker, &pool) != 0)
+      {
+	perror(FUNC_NAME ": pthread_create");
+	break;
+      }
+
+  if (started > 0)
+    stream_io(&pool);
+  else
+    pool.failed = 1;
+
+  for (i=0;i<started;i++)
+    pthread_join(tid[i], NULL);
+
+  /* whatever the I/O loop didn't get to finish */
+  for (i=0;i<conf->nstreams;i++)
+    {
+      if (pool.streams[i].state != S_DONE)
+	{
+	  stream_finish(&pool, &pool.streams[i]);
+	  pool.failed = 1;
+	}
+      free(pool.streams[i].name);
+    }
+
+  pthread_cond_destroy(&pool.cond);
+  pthread_mutex_destroy(&pool.lock);
+#ifndef _WIN32
+  close(pool.wake[0]);
+  close(pool.wake[1]);
+#endif
+  free(tid);
+  free(pool.queue);
+  free(pool.streams);
+
+  return(!pool.failed);
+}
+#undef FUNC_NAME
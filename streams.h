@@ -0,0 +1,47 @@
+/* streams.h: multi-stream output for the GMPBBS Blum Blum Shub PRNG
+
+  Copyright 2015 Maria Morisot.
+
+  This file is released under the GPL.
+
+  GMPBBS is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License,
+  or (at your option) any later version.
+
+  GMPBBS is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+  for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with GMPBBS; see the file LICENSE.  If not, write to
+  the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+  MA 02111-1307, USA.
+*/
+
+
+#ifndef _GMPBBS_STREAMS_H
+#define _GMPBBS_STREAMS_H 1
+
+#include "gmpbbs.h"
+
+/*
+  what gmpbbs_streams() does with each stream:
+    bbs only supplies the settings (improved, xor_urandom, profile),
+    every stream gets its own key_bitlen key and x.
+*/
+typedef struct
+{
+  const char *tmpl; /* output file name, printf style with one %d */
+  unsigned int nstreams;
+  uint64_t nbytes; /* per stream */
+  unsigned int key_bitlen;
+  int health; /* a FIPS 140-2 checker per stream */
+  unsigned int nthreads; /* 0: one per online CPU */
+} gmpbbs_streams_t;
+
+int gmpbbs_streams_check_template(const char *tmpl);
+int gmpbbs_streams(rndbbs_t *bbs, const gmpbbs_streams_t *conf);
+
+#endif /* _GMPBBS_STREAMS_H */
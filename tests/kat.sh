@@ -0,0 +1,124 @@
+#!/bin/sh
+#
+# kat.sh: known-answer tests for the GMPBBS Blum Blum Shub PRNG
+#
+#   usage: kat.sh [-g] [-P profile] <gmpbbs> [katfile]
+#
+# every vector is the POSIX cksum of the output of gmpbbs for a fixed
+# p, q and x, so any change to squaring, bit extraction or output
+# formatting shows up here.  with -g the vectors are recomputed from
+# <gmpbbs> and the katfile is written to stdout instead.  -P names the
+# build profile of <gmpbbs> (default, or lowmem for -DGMPBBS_LOWMEM).
+#
+# katfile lines:
+#   key <name> <p> <q>                        key for the lines below
+#   <crc> <bytes> <key> <gmpbbs arguments>    output of gmpbbs -p -q args
+#   @<profile> <crc> <bytes> <key> <args>     the same, for one profile only
+#   cipher <crc> <bytes> <key> <n> <x>        --encrypt -x x of n bytes of
+#                                             gmpbbs -x 5 -B n output, which
+#                                             must --decrypt back to them
+
+generate=0
+profile=default
+while [ $# -gt 0 ]; do
+  case "$1" in
+    -g) generate=1; shift ;;
+    -P) profile=$2; shift 2 ;;
+    *) break ;;
+  esac
+done
+
+if [ $# -lt 1 ]; then
+  echo "usage: $0 [-g] [-P profile] <gmpbbs> [katfile]" >&2
+  exit 2
+fi
+
+GMPBBS=$1
+KAT=${2:-$(dirname "$0")/kat.txt}
+TMP=${TMPDIR:-/tmp}/gmpbbs-kat.$$
+
+trap 'rm -f "$TMP".*' 0 1 2 15
+
+keyargs ()
+{
+  grep "^key $1 " "$KAT" | { read -r k name p q; echo "-p $p -q $q"; }
+}
+
+pass=0
+fail=0
+
+# report <line> <expected crc> <expected bytes> <crc> <bytes>
+report ()
+{
+  if [ "$2 $3" = "$4 $5" ]; then
+    pass=$((pass+1))
+  else
+    fail=$((fail+1))
+    echo "FAIL: $1" >&2
+    echo "      expected $2 $3, got $4 $5" >&2
+  fi
+}
+
+while read -r first rest; do
+  tag=
+  case "$first" in
+    @*)
+      if [ "$first" != "@$profile" ]; then
+	[ $generate = 1 ] && echo "$first $rest"
+	continue
+      fi
+      tag="$first "
+      set -- $rest
+      first=$1
+      shift
+      rest="$*"
+      ;;
+  esac
+  case "$first" in
+    ''|'#'*|key)
+      [ $generate = 1 ] && echo "$first${rest:+ $rest}"
+      continue
+      ;;
+    cipher)
+      set -- $rest
+      crc=$1; len=$2; key=$3; n=$4; x=$5
+      args=$(keyargs "$key")
+      if [ "$n" = 0 ]; then
+	: > "$TMP.plain"
+      else
+	$GMPBBS $args -x 5 -B "$n" > "$TMP.plain"
+      fi
+      got=$( $GMPBBS $args -x "$x" -E -j 2 -o "$TMP.enc" "$TMP.plain" &&
+	     cksum < "$TMP.enc" )
+      set -- $got
+      if [ $generate = 1 ]; then
+	echo "cipher $1 $2 $key $n $x"
+	continue
+      fi
+      report "cipher $key $n $x" "$crc" "$len" "$1" "$2"
+      if ! { $GMPBBS $args -D -j 3 -o "$TMP.dec" "$TMP.enc" &&
+	     cmp -s "$TMP.plain" "$TMP.dec"; }; then
+	fail=$((fail+1))
+	echo "FAIL: cipher $key $n $x: decrypt" >&2
+      fi
+      ;;
+    *)
+      crc=$first
+      set -- $rest
+      len=$1; key=$2
+      shift 2
+      got=$( $GMPBBS $(keyargs "$key") "$@" | cksum )
+      if [ $generate = 1 ]; then
+	echo "$tag$got $key $*"
+	continue
+      fi
+      set -- $got
+      report "$tag$rest" "$crc" "$len" "$1" "$2"
+      ;;
+  esac
+done < "$KAT"
+
+[ $generate = 1 ] && exit 0
+
+echo "$GMPBBS: $pass passed, $fail failed"
+[ $fail = 0 ]
@@ -0,0 +1,67 @@
+#!/bin/sh
+#
+# perf.sh: throughput regression gate for the GMPBBS Blum Blum Shub PRNG
+#
+#   usage: perf.sh [-r] <gmpbbs-bench> <baseline.csv> [threshold %]
+#
+# runs the generation benchmarks and fails if any of them got more than
+# threshold (default 15) percent slower than in the baseline.  rates are
+# from the fastest of the runs, the least noisy figure.  with -r this
+# run is written as the baseline instead (make perf-baseline); without a
+# baseline the check fails, so a slow build never quietly becomes the
+# reference.  baselines only mean something on the machine that
+# recorded them.
+
+record=0
+if [ "$1" = "-r" ]; then
+  record=1
+  shift
+fi
+
+if [ $# -lt 2 ]; then
+  echo "usage: $0 [-r] <gmpbbs-bench> <baseline.csv> [threshold %]" >&2
+  exit 2
+fi
+
+BENCH=$1
+BASELINE=$2
+THRESHOLD=${3:-15}
+TMP=${TMPDIR:-/tmp}/gmpbbs-perf.$$
+
+if [ $record = 0 ] && [ ! -s "$BASELINE" ]; then
+  echo "$BASELINE: no baseline, run make perf-baseline on a good build" >&2
+  exit 1
+fi
+
+trap 'rm -f "$TMP"' 0 1 2 15
+
+# benchmark,key_bitlen,param,rate (bytes or values per second)
+$BENCH -f csv -t bytes,xor,float -k 1024,2048 -n 65536 -r 7 -w 1 |
+  awk -F, 'NR > 1 { printf "%s,%s,%s,%.0f\n", $1, $2, $3, $4 / $6 }' \
+  > "$TMP" || exit 1
+
+if [ $record = 1 ]; then
+  cp "$TMP" "$BASELINE" || exit 1
+  echo "$BASELINE: recorded a new baseline"
+  cat "$BASELINE"
+  exit 0
+fi
+
+awk -F, -v threshold="$THRESHOLD" '
+  NR == FNR { base[$1 "," $2 "," $3] = $4; next }
+  {
+    name = $1 "," $2 "," $3
+    if (!(name in base))
+      {
+	printf "%-24s %12.0f/s   (not in baseline)\n", name, $4
+	next
+      }
+    change = 100 * ($4 - base[name]) / base[name]
+    slow = (change < -threshold)
+    printf "%-24s %12.0f/s   %+6.1f%%%s\n", name, $4, change,
+      slow ? "   REGRESSION" : ""
+    if (slow)
+      failed++
+  }
+  END { exit(failed > 0) }
+' "$BASELINE" "$TMP"